@@ -0,0 +1,256 @@
+import type { BarcodeType } from '../model/barcode-symbologies.ts';
+import {
+  type BaseBarcodeWasm,
+  fetchBarcodeWasm,
+  isMatrix2DBarcodeWasm,
+  MaskStrategy,
+  selectFont,
+} from './barcode-wasm.ts';
+import type { RasterizedFont } from './font-rasterizer.ts';
+
+interface LoadRequest {
+  kind: 'load';
+  id: number;
+  type: BarcodeType;
+  wasmFile: string;
+}
+
+interface AttachRequest {
+  kind: 'attach';
+  id: number;
+  canvas: OffscreenCanvas;
+}
+
+interface RenderRequest {
+  kind: 'render';
+  id: number;
+  dpr: number;
+  errorCorrectionLevel: number;
+  font?: RasterizedFont;
+  maxInputLength: number;
+  text: string;
+  type: BarcodeType;
+  wasmFile: string;
+}
+
+interface ExportRequest {
+  kind: 'export';
+  id: number;
+  mimeType: string;
+  quality: number;
+}
+
+type BarcodeWorkerRequest =
+  | AttachRequest
+  | ExportRequest
+  | LoadRequest
+  | RenderRequest;
+
+interface RenderResult {
+  currentBits: number;
+  height: number;
+  validText: string;
+  width: number;
+}
+
+type BarcodeWorkerResponse =
+  | { kind: 'dropped'; id: number }
+  | { kind: 'exported'; id: number; blob: Blob | null }
+  | { kind: 'failed'; id: number; message: string }
+  | { kind: 'loaded'; id: number }
+  | { kind: 'rendered'; id: number; result: RenderResult };
+
+const TEXT_ENCODER = new TextEncoder();
+/**
+ * Live previews keep mask selection within part of a 60 Hz frame; exports
+ * re-render with the exact mask first.
+ */
+const PREVIEW_MASK_BUDGET_US = 8000;
+
+let canvas: OffscreenCanvas | null = null;
+let font: RasterizedFont | null = null;
+let pendingRender: RenderRequest | null = null;
+let previewRender: RenderRequest | null = null;
+let isDrainScheduled = false;
+
+function respond(response: BarcodeWorkerResponse): void {
+  postMessage(response);
+}
+
+function respondWithError(id: number, error: unknown): void {
+  const message = error instanceof Error ? error.message : String(error);
+  respond({ kind: 'failed', id, message });
+}
+
+/**
+ * Renders the text and reads the QR bit budget from the segmentation the
+ * render left behind; measure() is only for probes that do not render.
+ */
+function evaluateBarcodeText(
+  originalText: string,
+  barcodeWasm: BaseBarcodeWasm,
+  maxInputLength: number,
+): { currentBits: number; isDrawn: boolean; validText: string } {
+  const inputPtr = barcodeWasm.get_data_buffer();
+  const wasmMem = new Uint8Array(barcodeWasm.memory.buffer);
+  const encodedText = TEXT_ENCODER.encode(originalText);
+  wasmMem.set(encodedText, inputPtr);
+  wasmMem[inputPtr + encodedText.length] = 0;
+  const isDrawn = barcodeWasm.render_into(
+    barcodeWasm.get_pixel_buffer(),
+    barcodeWasm.get_pixel_capacity(),
+  );
+  const currentBits = isMatrix2DBarcodeWasm(barcodeWasm)
+    ? barcodeWasm.get_remaining_bits()
+    : (maxInputLength - originalText.length) * 8;
+  return { currentBits, isDrawn: isDrawn !== 0, validText: originalText };
+}
+
+function paintCanvas(
+  barcodeWasm: BaseBarcodeWasm,
+  width: number,
+  height: number,
+): void {
+  const ctx = canvas?.getContext('2d');
+  if (!(canvas && ctx)) return;
+  canvas.width = width;
+  canvas.height = height;
+  const pixelData = new Uint8ClampedArray(
+    barcodeWasm.memory.buffer,
+    barcodeWasm.get_pixel_buffer(),
+    width * height * 4,
+  );
+  ctx.putImageData(new ImageData(pixelData, width, height), 0, 0);
+}
+
+async function renderBarcode(
+  request: RenderRequest,
+  isExact = false,
+): Promise<RenderResult | null> {
+  const barcodeWasm = await fetchBarcodeWasm(request.wasmFile, request.type);
+  if (pendingRender !== null) {
+    return null;
+  }
+  if (font !== null) {
+    selectFont(barcodeWasm, font);
+  }
+  barcodeWasm.set_dpr(request.dpr);
+  previewRender = null;
+  if (isMatrix2DBarcodeWasm(barcodeWasm)) {
+    barcodeWasm.set_error_correction_level(request.errorCorrectionLevel);
+    if (isExact) {
+      barcodeWasm.set_mask_strategy(MaskStrategy.Exact, 0);
+    } else {
+      barcodeWasm.set_mask_strategy(
+        MaskStrategy.Budgeted,
+        PREVIEW_MASK_BUDGET_US,
+      );
+      previewRender = request;
+    }
+  }
+  const { currentBits, isDrawn, validText } = evaluateBarcodeText(
+    request.text,
+    barcodeWasm,
+    request.maxInputLength,
+  );
+  const width = barcodeWasm.get_width();
+  const height = barcodeWasm.get_height();
+  if (isDrawn) {
+    paintCanvas(barcodeWasm, width, height);
+  }
+  return { currentBits, height, validText, width };
+}
+
+async function drainLatestRender(): Promise<void> {
+  const request = pendingRender;
+  pendingRender = null;
+  if (request !== null) {
+    try {
+      const result = await renderBarcode(request);
+      respond(
+        result === null
+          ? { kind: 'dropped', id: request.id }
+          : { kind: 'rendered', id: request.id, result },
+      );
+    } catch (error) {
+      respondWithError(request.id, error);
+    }
+  }
+  isDrainScheduled = false;
+  if (pendingRender !== null) {
+    scheduleDrain();
+  }
+}
+
+/**
+ * Renders run on a fresh task so that every request already queued behind
+ * the current one is received first; only the latest of them is rendered.
+ */
+function scheduleDrain(): void {
+  if (isDrainScheduled) return;
+  isDrainScheduled = true;
+  setTimeout(drainLatestRender, 0);
+}
+
+function enqueueRender(request: RenderRequest): void {
+  if (request.font !== undefined) {
+    font = request.font;
+  }
+  if (pendingRender !== null) {
+    respond({ kind: 'dropped', id: pendingRender.id });
+  }
+  pendingRender = request;
+  scheduleDrain();
+}
+
+async function loadSymbology(request: LoadRequest): Promise<void> {
+  try {
+    await fetchBarcodeWasm(request.wasmFile, request.type);
+    respond({ kind: 'loaded', id: request.id });
+  } catch (error) {
+    respondWithError(request.id, error);
+  }
+}
+
+async function exportCanvas(request: ExportRequest): Promise<void> {
+  try {
+    if (previewRender !== null) {
+      await renderBarcode(previewRender, true);
+    }
+    const blob = await canvas?.convertToBlob({
+      quality: request.quality,
+      type: request.mimeType,
+    });
+    respond({ kind: 'exported', id: request.id, blob: blob ?? null });
+  } catch (error) {
+    respondWithError(request.id, error);
+  }
+}
+
+function handleRequest(request: BarcodeWorkerRequest): void {
+  switch (request.kind) {
+    case 'attach':
+      canvas = request.canvas;
+      break;
+    case 'export':
+      exportCanvas(request);
+      break;
+    case 'load':
+      loadSymbology(request);
+      break;
+    case 'render':
+      enqueueRender(request);
+      break;
+  }
+}
+
+addEventListener('message', (event: MessageEvent<BarcodeWorkerRequest>) =>
+  handleRequest(event.data),
+);
+
+export type {
+  BarcodeWorkerRequest,
+  BarcodeWorkerResponse,
+  RenderRequest,
+  RenderResult,
+};
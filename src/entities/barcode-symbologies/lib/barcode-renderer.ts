@@ -0,0 +1,143 @@
+import type { BarcodeType } from '../model/barcode-symbologies.ts';
+import type {
+  BarcodeWorkerRequest,
+  BarcodeWorkerResponse,
+  RenderRequest,
+  RenderResult,
+} from './barcode-render.worker.ts';
+import type { RasterizedFont } from './font-rasterizer.ts';
+
+type RenderParams = Omit<RenderRequest, 'font' | 'id' | 'kind'> & {
+  font: RasterizedFont;
+};
+
+const pendingReplies = new Map<
+  number,
+  (response: BarcodeWorkerResponse) => void
+>();
+const loadedSymbologies = new Map<string, Promise<void>>();
+const attachedCanvases = new WeakSet<HTMLCanvasElement>();
+
+let worker: Worker | null = null;
+let lastRequestId = 0;
+let latestRenderId = 0;
+let sentFont: RasterizedFont | null = null;
+
+function handleResponse(event: MessageEvent<BarcodeWorkerResponse>): void {
+  const reply = pendingReplies.get(event.data.id);
+  pendingReplies.delete(event.data.id);
+  reply?.(event.data);
+}
+
+function getWorker(): Worker {
+  if (worker === null) {
+    worker = new Worker(
+      new URL('./barcode-render.worker.ts', import.meta.url),
+      { type: 'module' },
+    );
+    worker.addEventListener('message', handleResponse);
+  }
+  return worker;
+}
+
+function nextRequestId(): number {
+  lastRequestId += 1;
+  return lastRequestId;
+}
+
+function post(
+  request: BarcodeWorkerRequest,
+  transfer: Transferable[] = [],
+): void {
+  getWorker().postMessage(request, transfer);
+}
+
+function send(request: BarcodeWorkerRequest): Promise<BarcodeWorkerResponse> {
+  const reply = new Promise<BarcodeWorkerResponse>((resolve) => {
+    pendingReplies.set(request.id, resolve);
+  });
+  post(request);
+  return reply;
+}
+
+function assertNotFailed(response: BarcodeWorkerResponse): void {
+  if (response.kind === 'failed') {
+    throw new Error(response.message);
+  }
+}
+
+async function requestLoad(wasmFile: string, type: BarcodeType): Promise<void> {
+  const response = await send({
+    kind: 'load',
+    id: nextRequestId(),
+    type,
+    wasmFile,
+  });
+  assertNotFailed(response);
+}
+
+/**
+ * Resolves once the render worker has compiled and instantiated the given
+ * symbology, so components can suspend on it.
+ */
+function loadBarcodeSymbology(
+  wasmFile: string,
+  type: BarcodeType,
+): Promise<void> {
+  return loadedSymbologies.getOrInsertComputed(wasmFile, () =>
+    requestLoad(wasmFile, type),
+  );
+}
+
+function attachBarcodeCanvas(canvas: HTMLCanvasElement): void {
+  if (attachedCanvases.has(canvas)) return;
+  attachedCanvases.add(canvas);
+  const offscreen = canvas.transferControlToOffscreen();
+  post({ kind: 'attach', id: nextRequestId(), canvas: offscreen }, [offscreen]);
+}
+
+/**
+ * Resolves with `null` when a newer render superseded this one, either in the
+ * worker's queue or while its result was in flight.
+ */
+async function requestBarcodeRender({
+  font,
+  ...params
+}: RenderParams): Promise<RenderResult | null> {
+  const id = nextRequestId();
+  latestRenderId = id;
+  const isNewFont = font !== sentFont;
+  sentFont = font;
+  const response = await send({
+    ...params,
+    font: isNewFont ? font : undefined,
+    id,
+    kind: 'render',
+  });
+  assertNotFailed(response);
+  if (response.kind !== 'rendered' || id !== latestRenderId) {
+    return null;
+  }
+  return response.result;
+}
+
+async function exportBarcodeImage(
+  mimeType: string,
+  quality: number,
+): Promise<Blob | null> {
+  const response = await send({
+    kind: 'export',
+    id: nextRequestId(),
+    mimeType,
+    quality,
+  });
+  assertNotFailed(response);
+  return response.kind === 'exported' ? response.blob : null;
+}
+
+export {
+  attachBarcodeCanvas,
+  exportBarcodeImage,
+  loadBarcodeSymbology,
+  requestBarcodeRender,
+};
@@ -1,26 +1,131 @@
 import type { ReadonlyDeep } from 'type-fest';
 import { keysFromObject } from '@/shared/lib/array.ts';
-import { fetchWasmModule } from '@/shared/lib/wasm.ts';
+import { fetchWasmModule, hasWasmModule } from '@/shared/lib/wasm.ts';
 import { BarcodeType } from '../model/barcode-symbologies.ts';
+import type { RasterizedFont } from './font-rasterizer.ts';
 
 const GRAPHICS_LIB = 'graphics.wasm';
-const INITIAL_MEMORY_PAGES = 1024;
+const STATIC_VARIANT_SUFFIX = '.static';
+/**
+ * Static builds (`make bar-static`) are only preferred when the site is built
+ * with NEXT_PUBLIC_WASM_STATIC_BUILDS=true, as they are not part of `make bar`.
+ */
+const PREFER_STATIC_BUILDS =
+  process.env.NEXT_PUBLIC_WASM_STATIC_BUILDS === 'true';
+/**
+ * Module slots plus the shared font storage (see barcode.h); symbology modules
+ * grow the memory themselves once a canvas needs more pixels.
+ */
+const INITIAL_MEMORY_PAGES = 158;
+
+const SHEET_LAYOUT_SIZE = 16;
+const BATCH_RECORD_HEADER_SIZE = 4;
+const TEXT_ENCODER = new TextEncoder();
+
+const STATS_STAGE_COUNT = 5;
+const STATS_COUNTERS_OFFSET = 8 * (1 + STATS_STAGE_COUNT);
+
+/**
+ * How QR Code picks its mask; mirrors MASK_STRATEGY_* in qr_code.c. `Fixed`
+ * takes the mask number and `Budgeted` a render budget in microseconds.
+ */
+const MaskStrategy = {
+  Exact: 0,
+  Sampled: 1,
+  Fixed: 2,
+  Budgeted: 3,
+} as const;
+
+type MaskStrategy = (typeof MaskStrategy)[keyof typeof MaskStrategy];
 
 interface BaseBarcodeWasm {
   memory: WebAssembly.Memory;
-  get_custom_font_glyphs_buffer: () => number;
-  get_custom_font_widths_buffer: () => number;
+  get_batch_buffer: () => number;
+  get_batch_capacity: () => number;
   get_data_buffer: () => number;
+  get_font_generation: (fontId: number) => number;
+  get_font_upload_buffer: () => number;
   get_height: () => number;
   get_pixel_buffer: () => number;
+  get_pixel_capacity: () => number;
+  get_stats_buffer?: () => number;
   get_width: () => number;
+  measure: (ptr: number, len: number) => number;
+  register_font: (ptr: number, size: number) => number;
   render: () => void;
+  render_batch: (
+    recordsPtr: number,
+    recordsSize: number,
+    count: number,
+    layoutPtr: number,
+  ) => number;
+  render_into: (ptr: number, capacity: number) => number;
+  render_sequence?: (
+    startPtr: number,
+    count: number,
+    stride: number,
+    destPtr: number,
+    capacity: number,
+  ) => number;
+  set_bearer_bars?: (enabled: number) => void;
   set_dpr: (newDpr: number) => void;
+  set_font: (fontId: number) => number;
 }
 
 interface Matrix2DBarcodeWasm extends BaseBarcodeWasm {
   get_remaining_bits: () => number;
   set_error_correction_level: (level: number) => void;
+  set_mask_strategy: (strategy: MaskStrategy, param: number) => void;
+}
+
+interface BarcodeStats {
+  totalMs: number;
+  stageMs: {
+    encode: number;
+    errorCorrection: number;
+    masking: number;
+    raster: number;
+    text: number;
+  };
+  segmentPasses: number;
+  rsBlocksEncoded: number;
+  masksScored: number;
+  fillRectCalls: number;
+  pixelsWritten: number;
+  glyphsDrawn: number;
+}
+
+interface SharedRuntime {
+  memory: WebAssembly.Memory;
+  graphicsExports: WebAssembly.Exports;
+}
+
+interface BarcodeMeasurement {
+  version: number;
+  usedBits: number;
+  remainingBits: number;
+  segments: number;
+  modules: number;
+  width: number;
+  height: number;
+}
+
+interface SheetLayout {
+  cellWidth: number;
+  cellHeight: number;
+  gutter: number;
+  columns: number;
+}
+
+interface BarcodeSheet {
+  drawn: number;
+  width: number;
+  height: number;
+}
+
+interface RegisteredFont {
+  generation: number;
+  id: number;
 }
 
 type BarcodeWasmMap = {
@@ -31,14 +136,22 @@ type BarcodeWasmMap = {
 const BASE_REQUIRED_FUNCTIONS: ReadonlyDeep<
   Exclude<keyof BaseBarcodeWasm, 'memory'>[]
 > = keysFromObject({
-  get_custom_font_glyphs_buffer: true,
-  get_custom_font_widths_buffer: true,
+  get_batch_buffer: true,
+  get_batch_capacity: true,
   get_data_buffer: true,
+  get_font_generation: true,
+  get_font_upload_buffer: true,
   get_height: true,
   get_pixel_buffer: true,
+  get_pixel_capacity: true,
   get_width: true,
+  measure: true,
+  register_font: true,
   render: true,
+  render_batch: true,
+  render_into: true,
   set_dpr: true,
+  set_font: true,
 });
 
 const MATRIX_2D_REQUIRED_FUNCTIONS: ReadonlyDeep<
@@ -46,10 +159,14 @@ const MATRIX_2D_REQUIRED_FUNCTIONS: ReadonlyDeep<
 > = keysFromObject({
   get_remaining_bits: true,
   set_error_correction_level: true,
+  set_mask_strategy: true,
 });
 
-const graphicsLibCache = new Map<string, Promise<WebAssembly.Module>>();
+const sharedRuntimeCache = new Map<string, Promise<SharedRuntime>>();
 const barcodesCache = new Map<string, Promise<unknown>>();
+const registeredFonts = new WeakMap<RasterizedFont, RegisteredFont>();
+
+let sharedMemory: WebAssembly.Memory | null = null;
 
 function isMatrix2DBarcodeWasm(value: unknown): value is Matrix2DBarcodeWasm {
   return (
@@ -60,6 +177,133 @@ function isMatrix2DBarcodeWasm(value: unknown): value is Matrix2DBarcodeWasm {
   );
 }
 
+function readBarcodeStats(
+  barcodeWasm: BaseBarcodeWasm,
+): BarcodeStats | null {
+  const statsPtr = barcodeWasm.get_stats_buffer?.() ?? 0;
+  if (statsPtr === 0) {
+    return null;
+  }
+  const view = new DataView(barcodeWasm.memory.buffer, statsPtr);
+  const stage = (index: number) => view.getFloat64(8 * (1 + index), true);
+  const counter = (index: number) =>
+    view.getUint32(STATS_COUNTERS_OFFSET + 4 * index, true);
+  return {
+    totalMs: view.getFloat64(0, true),
+    stageMs: {
+      encode: stage(0),
+      errorCorrection: stage(1),
+      masking: stage(2),
+      raster: stage(3),
+      text: stage(4),
+    },
+    segmentPasses: counter(0),
+    rsBlocksEncoded: counter(1),
+    masksScored: counter(2),
+    fillRectCalls: counter(3),
+    pixelsWritten: counter(4),
+    glyphsDrawn: counter(5),
+  };
+}
+
+/**
+ * Renders every payload onto one sheet with a single call into the module. The
+ * layout and the length-prefixed records share the module's batch buffer; the
+ * sheet is left in the pixel buffer, sized as reported. The module formats each
+ * payload as the editor would and leaves the cells of rejected ones blank.
+ */
+function renderBarcodeSheet(
+  barcodeWasm: BaseBarcodeWasm,
+  payloads: readonly string[],
+  layout: SheetLayout,
+): BarcodeSheet {
+  const records = payloads.map((payload) => TEXT_ENCODER.encode(payload));
+  const size = records.reduce(
+    (total, record) => total + BATCH_RECORD_HEADER_SIZE + record.length,
+    SHEET_LAYOUT_SIZE,
+  );
+  if (size > barcodeWasm.get_batch_capacity()) {
+    throw new RangeError(`Barcode batch of ${size} bytes exceeds the buffer`);
+  }
+  const layoutPtr = barcodeWasm.get_batch_buffer();
+  const view = new DataView(barcodeWasm.memory.buffer, layoutPtr, size);
+  view.setInt32(0, layout.cellWidth, true);
+  view.setInt32(4, layout.cellHeight, true);
+  view.setInt32(8, layout.gutter, true);
+  view.setInt32(12, layout.columns, true);
+  const bytes = new Uint8Array(barcodeWasm.memory.buffer, layoutPtr, size);
+  let offset = SHEET_LAYOUT_SIZE;
+  for (const record of records) {
+    view.setUint32(offset, record.length, true);
+    bytes.set(record, offset + BATCH_RECORD_HEADER_SIZE);
+    offset += BATCH_RECORD_HEADER_SIZE + record.length;
+  }
+  const drawn = barcodeWasm.render_batch(
+    layoutPtr + SHEET_LAYOUT_SIZE,
+    size - SHEET_LAYOUT_SIZE,
+    records.length,
+    layoutPtr,
+  );
+  return {
+    drawn,
+    width: barcodeWasm.get_width(),
+    height: barcodeWasm.get_height(),
+  };
+}
+
+function measureBarcode(
+  barcodeWasm: BaseBarcodeWasm,
+  ptr: number,
+  len: number,
+): BarcodeMeasurement {
+  const measurementPtr = barcodeWasm.measure(ptr, len);
+  const view = new DataView(barcodeWasm.memory.buffer, measurementPtr);
+  const field = (index: number) => view.getInt32(4 * index, true);
+  return {
+    version: field(0),
+    usedBits: field(1),
+    remainingBits: field(2),
+    segments: field(3),
+    modules: field(4),
+    width: field(5),
+    height: field(6),
+  };
+}
+
+function registerFont(
+  barcodeWasm: BaseBarcodeWasm,
+  font: RasterizedFont,
+): RegisteredFont {
+  const uploadPtr = barcodeWasm.get_font_upload_buffer();
+  const wasmMem = new Uint8Array(barcodeWasm.memory.buffer);
+  wasmMem.set(font.widths, uploadPtr);
+  wasmMem.set(font.glyphs, uploadPtr + font.widths.length);
+  const id = barcodeWasm.register_font(
+    uploadPtr,
+    font.widths.length + font.glyphs.length,
+  );
+  if (id < 0) {
+    throw new Error(`Failed to register font "${font.name}"`);
+  }
+  return { generation: barcodeWasm.get_font_generation(id), id };
+}
+
+/**
+ * Fonts are uploaded once into the registry shared by every module; a changed
+ * generation means the slot was recycled and the font has to be re-uploaded.
+ */
+function selectFont(barcodeWasm: BaseBarcodeWasm, font: RasterizedFont): void {
+  let registered = registeredFonts.get(font);
+  if (
+    registered === undefined ||
+    barcodeWasm.get_font_generation(registered.id) !== registered.generation
+  ) {
+    registered = registerFont(barcodeWasm, font);
+    registeredFonts.set(font, registered);
+  }
+  barcodeWasm.set_font(registered.id);
+}
+
 function assertIsBarcodeWasm<T extends BarcodeType>(
   value: unknown,
   barcodeType: T,
@@ -87,26 +331,84 @@ function assertIsBarcodeWasm<T extends BarcodeType>(
   }
 }
 
-function fetchGraphicsLibWasm(): Promise<WebAssembly.Module> {
-  return graphicsLibCache.getOrInsertComputed(GRAPHICS_LIB, fetchWasmModule);
+function getSharedMemory(): WebAssembly.Memory {
+  if (sharedMemory === null) {
+    sharedMemory = new WebAssembly.Memory({
+      initial: INITIAL_MEMORY_PAGES,
+    });
+  }
+  return sharedMemory;
+}
+
+async function instantiateSharedRuntime(
+  graphicsFileName: string,
+): Promise<SharedRuntime> {
+  const graphicsLib = await fetchWasmModule(graphicsFileName);
+  const memory = getSharedMemory();
+  const graphicsLibInstance = await WebAssembly.instantiate(graphicsLib, {
+    env: { memory },
+  });
+  return { memory, graphicsExports: graphicsLibInstance.exports };
+}
+
+function fetchSharedRuntime(): Promise<SharedRuntime> {
+  return sharedRuntimeCache.getOrInsertComputed(
+    GRAPHICS_LIB,
+    instantiateSharedRuntime,
+  );
+}
+
+function toStaticVariant(fileName: string): string {
+  return fileName.replace(/\.wasm$/, `${STATIC_VARIANT_SUFFIX}.wasm`);
+}
+
+async function instantiateLinkedModule(
+  fileName: string,
+): Promise<WebAssembly.Instance> {
+  const [{ memory, graphicsExports }, barcodeModule] = await Promise.all([
+    fetchSharedRuntime(),
+    fetchWasmModule(fileName),
+  ]);
+  const imports = {
+    env: {
+      memory,
+      now: () => performance.now(),
+      ...graphicsExports,
+    },
+  };
+  return WebAssembly.instantiate(barcodeModule, imports);
 }
 
+/**
+ * Static builds carry the graphics runtime, so they only import the shared
+ * memory and the clock; graphics.wasm is not loaded for them.
+ */
+async function instantiateStaticModule(
+  fileName: string,
+): Promise<WebAssembly.Instance> {
+  const barcodeModule = await fetchWasmModule(fileName);
+  const imports = {
+    env: {
+      memory: getSharedMemory(),
+      now: () => performance.now(),
+    },
+  };
+  return WebAssembly.instantiate(barcodeModule, imports);
+}
+
+/**
+ * When opted in, prefers the static build of a symbology if the manifest lists
+ * it, where drawing calls are inlined instead of crossing into graphics.wasm.
+ */
 async function instantiateBarcodeWasm<T extends BarcodeType>(
   fileName: string,
   barcodeType: T,
 ): Promise<BarcodeWasmMap[T]> {
-  const [graphicsLib, barcodeModule] = await Promise.all([
-    fetchGraphicsLibWasm(),
-    fetchWasmModule(fileName),
-  ]);
-  const memory = new WebAssembly.Memory({
-    initial: INITIAL_MEMORY_PAGES,
-  });
-  const graphicsLibInstance = await WebAssembly.instantiate(graphicsLib, {
-    env: { memory },
-  });
-  const imports = { env: { memory, ...graphicsLibInstance.exports } };
-  const instance = await WebAssembly.instantiate(barcodeModule, imports);
+  const staticFileName = toStaticVariant(fileName);
+  const instance =
+    PREFER_STATIC_BUILDS && (await hasWasmModule(staticFileName))
+    ? await instantiateStaticModule(staticFileName)
+    : await instantiateLinkedModule(fileName);
   const { exports } = instance;
   assertIsBarcodeWasm(exports, barcodeType);
   return exports;
@@ -122,9 +424,18 @@ function fetchBarcodeWasm<T extends BarcodeType>(
 }
 
 export {
+  type BarcodeMeasurement,
+  type BarcodeSheet,
+  type BarcodeStats,
   type BarcodeWasmMap,
   type BaseBarcodeWasm,
   fetchBarcodeWasm,
   isMatrix2DBarcodeWasm,
+  MaskStrategy,
   type Matrix2DBarcodeWasm,
+  measureBarcode,
+  readBarcodeStats,
+  renderBarcodeSheet,
+  selectFont,
+  type SheetLayout,
 };
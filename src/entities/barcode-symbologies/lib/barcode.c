@@ -5,15 +5,54 @@
 #include "barcode.h"
 #include "graphics.h"
 
+#ifndef __wasm__
+#include <time.h>
+#endif
+
 char data_buffer[BARCODE_BUFFER_SIZE];
+uint8_t batch_buffer[BATCH_BUFFER_SIZE];
 int canvas_height = 0;
 int canvas_width = 0;
 int dpr = 1;
 int symbol_buffer[BARCODE_BUFFER_SIZE];
-uint32_t pixels[MAX_WIDTH * MAX_HEIGHT];
 
-uint8_t custom_font_glyphs[CUSTOM_FONT_GLYPH_COUNT * CUSTOM_FONT_GLYPH_SIZE * CUSTOM_FONT_GLYPH_SIZE];
-uint8_t custom_font_widths[CUSTOM_FONT_GLYPH_COUNT];
+#ifdef __wasm__
+#define SHARED_RUNTIME ((SharedRuntime *)SHARED_RUNTIME_BASE)
+#else
+static SharedRuntime shared_runtime;
+#define SHARED_RUNTIME (&shared_runtime)
+#endif
+
+uint32_t *const pixels = SHARED_RUNTIME->pixels;
+
+BarcodeMeasurement measurement;
+BarRunList bar_runs;
+
+static int current_font_id = NO_FONT;
+
+static uint32_t *render_target = SHARED_RUNTIME->pixels;
+static size_t render_target_capacity = (size_t)MAX_WIDTH * MAX_HEIGHT;
+static bool has_drawn_into_target = false;
+static Canvas render_cell = {0};
+
+#ifdef BARCODE_STATS
+BarcodeStats stats;
+
+static double render_started_at;
+static double stage_started_at[STATS_STAGE_COUNT];
+#endif
+
+/**
+ * @brief Milliseconds from a monotonic clock; wasm builds import the host's performance.now() instead (see barcode.h).
+ */
+#ifndef __wasm__
+double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double)ts.tv_sec * 1e3) + ((double)ts.tv_nsec / 1e6);
+}
+#endif
 
 bool is_control_char(char c)
 {
@@ -35,6 +74,30 @@ bool is_uppercased_alpha(char c)
     return c >= ASCII_UPPERCASED_A && c <= ASCII_UPPERCASED_Z;
 }
 
+bool reserve_pixel_buffer(size_t pixel_count)
+{
+    if (pixel_count > (size_t)MAX_WIDTH * MAX_HEIGHT)
+        return false;
+#ifdef __wasm__
+    size_t required_end = (size_t)(uintptr_t)(pixels + pixel_count);
+    size_t required_pages = (required_end + WASM_PAGE_SIZE - 1) / WASM_PAGE_SIZE;
+    size_t current_pages = __builtin_wasm_memory_size(0);
+    if (required_pages > current_pages && SIZE_MAX == __builtin_wasm_memory_grow(0, required_pages - current_pages))
+        return false;
+#endif
+    return true;
+}
+
+/**
+ * @brief Makes pixel_count pixels at dest writable: dest may point into the shared pixel region, whose memory is
+ * only grown on demand. Other destinations belong to the caller.
+ */
+bool reserve_render_target(const uint32_t *dest, size_t pixel_count)
+{
+    bool is_shared_target = dest >= pixels && dest < pixels + get_pixel_capacity();
+    return !is_shared_target || reserve_pixel_buffer((size_t)(dest - pixels) + pixel_count);
+}
+
 bool wasm_strncmp(const char *s1, const char *s2, int n)
 {
     for (int i = 0; i < n; ++i)
@@ -43,6 +106,80 @@ bool wasm_strncmp(const char *s1, const char *s2, int n)
     return true;
 }
 
+/**
+ * @brief The canvas the current symbol draws on: a view centered in render_cell during a batch, else the start of
+ * the render target.
+ */
+Canvas create_symbol_canvas(void)
+{
+    if (NULL != render_cell.pixels) {
+        if (canvas_width > render_cell.width || canvas_height > render_cell.height)
+            return CANVAS_NULL;
+        has_drawn_into_target = true;
+        return canvas_subview(&render_cell, (render_cell.width - canvas_width) / 2,
+                              (render_cell.height - canvas_height) / 2, canvas_width, canvas_height);
+    }
+    size_t pixel_count = (size_t)canvas_width * (size_t)canvas_height;
+    if (pixel_count > render_target_capacity)
+        return CANVAS_NULL;
+    if (!reserve_render_target(render_target, pixel_count))
+        return CANVAS_NULL;
+    has_drawn_into_target = true;
+    return canvas_create(render_target, canvas_width, canvas_height);
+}
+
+const char *load_data_buffer(const char *data, int len)
+{
+    if (NULL == data || len < 0)
+        len = 0;
+    else if (len > BARCODE_BUFFER_SIZE - 1)
+        len = BARCODE_BUFFER_SIZE - 1;
+    if (data != data_buffer)
+        rt_copy(data_buffer, data, (size_t)len);
+    data_buffer[len] = NULL_TERMINATOR;
+    return data_buffer;
+}
+
+/**
+ * @brief Makes the measured input available where the encoders read it: the data buffer, NUL-terminated at len.
+ */
+const char *load_measure_input(const char *data, int len)
+{
+    measurement = (BarcodeMeasurement){0};
+    return load_data_buffer(data, len);
+}
+
+/**
+ * @brief Fits the len bytes in data_buffer to digit_count digits, truncating or padding with '0' on the right like
+ * the editor, and clears the check digit slot after them. Returns false on any non-digit.
+ */
+bool pad_digit_data(int len, int digit_count)
+{
+    for (int i = 0; i < len; ++i)
+        if (!is_digit(data_buffer[i]))
+            return false;
+    for (int i = len; i < digit_count; ++i)
+        data_buffer[i] = ASCII_ZERO;
+    data_buffer[digit_count] = NULL_TERMINATOR;
+    data_buffer[digit_count + 1] = NULL_TERMINATOR;
+    return true;
+}
+
+/**
+ * @brief Loads exactly digit_count digits from data into data_buffer. Returns false, loading nothing, unless all of
+ * them are ASCII digits.
+ */
+bool load_digit_data(const char *data, int digit_count)
+{
+    if (NULL == data)
+        return false;
+    for (int i = 0; i < digit_count; ++i)
+        if (!is_digit(data[i]))
+            return false;
+    load_data_buffer(data, digit_count);
+    return pad_digit_data(digit_count, digit_count);
+}
+
 char digit_to_char(int d)
 {
     return (char)(d + ASCII_ZERO);
@@ -53,15 +190,78 @@ int char_to_digit(char c)
     return c - ASCII_ZERO;
 }
 
-int draw_pattern(Canvas *c, const char *const pattern, int x, int y, int module_width, int bar_height)
+void reset_bar_runs(BarRunList *list)
+{
+    list->count = 0;
+    list->is_overflowed = false;
+}
+
+static inline void push_bar_run(BarRunList *list, uint16_t run)
+{
+    if (list->count >= MAX_BAR_RUNS) {
+        list->is_overflowed = true;
+        return;
+    }
+    list->runs[list->count++] = run;
+}
+
+/**
+ * @brief Appends a bar or space, widening the last run when it has the same color (and, for bars, the same guard
+ * flag). A leading space or two differently flagged bars are kept apart by a zero-width run of the other color.
+ */
+void append_bar_run(BarRunList *list, bool is_bar, int width, bool is_guard)
+{
+    if (width <= 0)
+        return;
+    uint16_t guard = is_bar && is_guard ? BAR_RUN_GUARD : 0;
+    bool is_last_bar = 1 == (list->count & 1);
+    if (0 < list->count && is_last_bar == is_bar) {
+        uint16_t *last = &list->runs[list->count - 1];
+        int merged_width = (*last & BAR_RUN_WIDTH_MASK) + width;
+        if ((*last & BAR_RUN_GUARD) == guard && merged_width <= BAR_RUN_WIDTH_MASK) {
+            *last = (uint16_t)(guard | merged_width);
+            return;
+        }
+        push_bar_run(list, 0);
+    } else if (0 == list->count && !is_bar) {
+        push_bar_run(list, 0);
+    }
+    push_bar_run(list, (uint16_t)(guard | width));
+}
+
+/**
+ * @brief Appends module_count (at most 16) modules packed most significant first, a set bit per bar module. Each run
+ * is found with one count-leading-zeros instead of a test per module.
+ */
+void append_bar_bits(BarRunList *list, uint32_t bits, int module_count, bool is_guard)
+{
+    if (module_count <= 0)
+        return;
+    uint32_t pending = bits << (32 - module_count);
+    int remaining = module_count;
+    while (0 < remaining) {
+        bool is_bar = 0 != (pending & 0x80000000u);
+        uint32_t run_bits = is_bar ? ~pending : pending;
+        int run = 0 == run_bits ? remaining : MATH_MIN(__builtin_clz(run_bits), remaining);
+        append_bar_run(list, is_bar, run, is_guard);
+        pending <<= run;
+        remaining -= run;
+    }
+}
+
+/**
+ * @brief Fills one rect per bar, unit_px wide per width unit, and returns the width covered. Guard bars are
+ * guard_height tall, the others bar_height.
+ */
+int emit_bar_runs(Canvas *c, const BarRunList *list, int x, int y, int unit_px, int bar_height, int guard_height)
 {
     int curr_x = x;
-    int i = 0;
-    while (NULL_TERMINATOR != pattern[i]) {
-        if (BAR == pattern[i])
-            canvas_fill_rect(c, curr_x, y, module_width, bar_height, C_BLACK);
-        curr_x += module_width;
-        ++i;
+    for (int i = 0; i < list->count; ++i) {
+        uint16_t run = list->runs[i];
+        int width_px = (run & BAR_RUN_WIDTH_MASK) * unit_px;
+        if (0 == (i & 1) && 0 < width_px)
+            canvas_fill_rect(c, curr_x, y, width_px, (run & BAR_RUN_GUARD) ? guard_height : bar_height, C_BLACK);
+        curr_x += width_px;
     }
     return curr_x - x;
 }
@@ -85,13 +285,49 @@ int wasm_strlen(const char *s)
     return i;
 }
 
-void *wasm_memset(void *dest, int c, size_t n)
+static inline int get_sequence_weight(const DigitSequence *seq, int position)
+{
+    return 0 == ((seq->len - 1 - position) & 1) ? seq->odd_pos_weight : seq->even_pos_weight;
+}
+
+/**
+ * @brief Starts a serial sequence over the first len digits of the data buffer, which the mod 10 checksum covers.
+ */
+void begin_digit_sequence(DigitSequence *seq, int len, int odd_pos_weight, int even_pos_weight)
+{
+    *seq = (DigitSequence){.len = len, .odd_pos_weight = odd_pos_weight, .even_pos_weight = even_pos_weight};
+    for (int i = 0; i < len; ++i)
+        seq->weighted_sum += char_to_digit(data_buffer[i]) * get_sequence_weight(seq, i);
+}
+
+/**
+ * @brief Adds stride to the sequence's digits in place, wrapping past the last value. The checksum sum is updated by
+ * each changed digit's weighted delta; returns a mask with bit i set when digit i changed.
+ */
+uint32_t advance_digit_sequence(DigitSequence *seq, int stride)
 {
-    unsigned char *p = dest;
-    while (--n) {
-        *p++ = (unsigned char)c;
+    uint32_t changed = 0;
+    int carry = stride;
+    for (int i = seq->len - 1; i >= 0 && 0 < carry; --i) {
+        int digit = char_to_digit(data_buffer[i]);
+        int next = digit + (carry % DIGITS_COUNT);
+        carry /= DIGITS_COUNT;
+        if (next >= DIGITS_COUNT) {
+            next -= DIGITS_COUNT;
+            ++carry;
+        }
+        if (next == digit)
+            continue;
+        data_buffer[i] = digit_to_char(next);
+        seq->weighted_sum += (next - digit) * get_sequence_weight(seq, i);
+        changed |= 1u << i;
     }
-    return dest;
+    return changed;
+}
+
+int get_sequence_checksum(const DigitSequence *seq)
+{
+    return (DIGITS_COUNT - (seq->weighted_sum % DIGITS_COUNT)) % DIGITS_COUNT;
 }
 
 char *get_data_buffer(void)
@@ -114,6 +350,110 @@ uint32_t *get_pixel_buffer(void)
     return pixels;
 }
 
+const BarRunList *get_bar_runs(void)
+{
+    return &bar_runs;
+}
+
+size_t get_pixel_capacity(void)
+{
+    return (size_t)MAX_WIDTH * MAX_HEIGHT;
+}
+
+/**
+ * @brief Renders the current data into a caller-provided buffer of capacity pixels. Returns false, leaving dest
+ * untouched, when the data does not encode or the symbol would not fit; canvas_width/height still report its size.
+ */
+bool render_into(uint32_t *dest, size_t capacity)
+{
+    if (NULL == dest)
+        return false;
+    render_target = dest;
+    render_target_capacity = capacity;
+    has_drawn_into_target = false;
+    render();
+    render_target = pixels;
+    render_target_capacity = get_pixel_capacity();
+    return has_drawn_into_target;
+}
+
+uint8_t *get_batch_buffer(void)
+{
+    return batch_buffer;
+}
+
+size_t get_batch_capacity(void)
+{
+    return BATCH_BUFFER_SIZE;
+}
+
+static inline uint32_t read_record_length(const uint8_t *record)
+{
+    return (uint32_t)record[0] | ((uint32_t)record[1] << 8) | ((uint32_t)record[2] << 16) | ((uint32_t)record[3] << 24);
+}
+
+static inline bool is_valid_sheet_layout(const SheetLayout *layout)
+{
+    return NULL != layout && layout->cell_width > 0 && layout->cell_height > 0 && layout->gutter >= 0 &&
+           layout->columns > 0;
+}
+
+static inline int64_t get_sheet_extent(int cells, int cell_size, int gutter)
+{
+    return ((int64_t)cells * cell_size) + ((int64_t)(cells - 1) * gutter);
+}
+
+/**
+ * @brief Renders count length-prefixed payloads (a little-endian uint32 length, then the bytes) from the
+ * records_size bytes at records into one sheet, each symbol centered in its cell. Payloads go through
+ * normalize_data() first; those it rejects, and symbols that do not encode or do not fit their cell, leave their cell
+ * blank. A record running past records_size ends the batch. The sheet becomes the canvas; returns how many symbols
+ * were drawn.
+ */
+int render_batch(const uint8_t *records, size_t records_size, int count, const SheetLayout *layout)
+{
+    if (NULL == records || count <= 0 || !is_valid_sheet_layout(layout))
+        return 0;
+    int columns = MATH_MIN(layout->columns, count);
+    int rows = (count + columns - 1) / columns;
+    int64_t sheet_width = get_sheet_extent(columns, layout->cell_width, layout->gutter);
+    int64_t sheet_height = get_sheet_extent(rows, layout->cell_height, layout->gutter);
+    if (sheet_width * sheet_height > (int64_t)get_pixel_capacity())
+        return 0;
+    canvas_width = (int)sheet_width;
+    canvas_height = (int)sheet_height;
+    Canvas sheet = create_symbol_canvas();
+    canvas_fill_rect(&sheet, 0, 0, sheet.width, sheet.height, C_WHITE);
+    int drawn = 0;
+    size_t offset = 0;
+    for (int i = 0; i < count && NULL != sheet.pixels; ++i) {
+        if (records_size - offset < BATCH_RECORD_HEADER_SIZE)
+            break;
+        uint32_t len = read_record_length(records + offset);
+        offset += BATCH_RECORD_HEADER_SIZE;
+        if (len > records_size - offset)
+            break;
+        const char *payload = (const char *)records + offset;
+        offset += len;
+        if (len >= BARCODE_BUFFER_SIZE)
+            continue;
+        load_data_buffer(payload, (int)len);
+        if (!normalize_data((int)len))
+            continue;
+        int cell_x = (i % columns) * (layout->cell_width + layout->gutter);
+        int cell_y = (i / columns) * (layout->cell_height + layout->gutter);
+        render_cell = canvas_subview(&sheet, cell_x, cell_y, layout->cell_width, layout->cell_height);
+        has_drawn_into_target = false;
+        render();
+        if (has_drawn_into_target)
+            ++drawn;
+    }
+    render_cell = CANVAS_NULL;
+    canvas_width = sheet.width;
+    canvas_height = sheet.height;
+    return drawn;
+}
+
 void set_dpr(int user_dpr)
 {
     if (user_dpr < MIN_DPR)
@@ -123,19 +463,95 @@ void set_dpr(int user_dpr)
     dpr = user_dpr;
 }
 
-uint8_t *get_custom_font_widths_buffer(void)
+uint8_t *get_font_upload_buffer(void)
+{
+    return SHARED_RUNTIME->font_upload;
+}
+
+static inline bool is_registered_font(int font_id)
 {
-    return custom_font_widths;
+    return font_id >= 0 && font_id < MAX_REGISTERED_FONTS && 0 != SHARED_RUNTIME->fonts[font_id].generation;
 }
 
-uint8_t *get_custom_font_glyphs_buffer(void)
+/**
+ * @brief Copies a font laid out as widths followed by glyphs into the next registry slot, recycling the oldest one
+ * once all are taken. Fonts live in shared memory, so every module sees the same registry.
+ */
+int register_font(const uint8_t *data, size_t size)
 {
-    return custom_font_glyphs;
+    if (NULL == data || CUSTOM_FONT_UPLOAD_SIZE != size)
+        return NO_FONT;
+    int font_id = (int)(SHARED_RUNTIME->next_font_slot % MAX_REGISTERED_FONTS);
+    FontSlot *slot = &SHARED_RUNTIME->fonts[font_id];
+    rt_copy(slot->widths, data, CUSTOM_FONT_GLYPH_COUNT);
+    rt_copy(slot->glyphs, data + CUSTOM_FONT_GLYPH_COUNT, CUSTOM_FONT_GLYPHS_SIZE);
+    slot->generation = ++SHARED_RUNTIME->font_generation;
+    ++SHARED_RUNTIME->next_font_slot;
+    return font_id;
+}
+
+bool set_font(int font_id)
+{
+    if (!is_registered_font(font_id))
+        return false;
+    current_font_id = font_id;
+    return true;
 }
 
-static inline CanvasFont get_standard_font(void)
+uint32_t get_font_generation(int font_id)
 {
-    return (CanvasFont){.size = CUSTOM_FONT_GLYPH_SIZE, .widths = custom_font_widths, .glyphs = custom_font_glyphs};
+    return is_registered_font(font_id) ? SHARED_RUNTIME->fonts[font_id].generation : 0;
+}
+
+#ifdef BARCODE_STATS
+void stats_render_begin(void)
+{
+    stats = (BarcodeStats){0};
+#ifdef GRAPHICS_STATS
+    canvas_reset_stats();
+#endif
+    render_started_at = now();
+}
+
+void stats_render_end(void)
+{
+    stats.total_ms = now() - render_started_at;
+#ifdef GRAPHICS_STATS
+    const CanvasStats *canvas_stats = canvas_get_stats();
+    stats.fill_rect_calls = canvas_stats->fill_rect_calls;
+    stats.pixels_written = canvas_stats->pixels_written;
+    stats.glyphs_drawn = canvas_stats->glyphs_drawn;
+#endif
+}
+
+void stats_stage_begin(StatsStage stage)
+{
+    stage_started_at[stage] = now();
+}
+
+void stats_stage_end(StatsStage stage)
+{
+    stats.stage_ms[stage] += now() - stage_started_at[stage];
+}
+
+void *get_stats_buffer(void)
+{
+    return &stats;
+}
+#else
+void *get_stats_buffer(void)
+{
+    return NULL;
+}
+#endif
+
+static inline bool get_standard_font(CanvasFont *font)
+{
+    if (!is_registered_font(current_font_id))
+        return false;
+    const FontSlot *slot = &SHARED_RUNTIME->fonts[current_font_id];
+    *font = (CanvasFont){.size = CUSTOM_FONT_GLYPH_SIZE, .widths = slot->widths, .glyphs = slot->glyphs};
+    return true;
 }
 
 static inline float get_text_scale(CanvasFont font)
@@ -146,13 +562,17 @@ static inline float get_text_scale(CanvasFont font)
 
 int measure_text(const char *text)
 {
-    CanvasFont font = get_standard_font();
+    CanvasFont font;
+    if (!get_standard_font(&font))
+        return 0;
     return canvas_measure_text(text, font, get_text_scale(font), 0.0f);
 }
 
 void draw_text(Canvas *c, const char *text, int x, int y)
 {
-    CanvasFont font = get_standard_font();
+    CanvasFont font;
+    if (!get_standard_font(&font))
+        return;
     canvas_draw_text(c, text, x, y, font, get_text_scale(font), C_BLACK, 0.0f);
 }
 
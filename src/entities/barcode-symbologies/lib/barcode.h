@@ -6,11 +6,14 @@
 #include <stdint.h>
 
 #include "graphics.h"
+#include "runtime.h"
 
 #ifdef __wasm__
 #define WASM_EXPORT(name) __attribute__((export_name(name)))
+#define WASM_IMPORT(name) __attribute__((import_module("env"), import_name(name)))
 #else
 #define WASM_EXPORT(name)
+#define WASM_IMPORT(name)
 #endif
 
 #define ASCII_LOWERCASED_A 'a'
@@ -20,7 +23,6 @@
 #define ASCII_UPPERCASED_A 'A'
 #define ASCII_UPPERCASED_Z 'Z'
 #define ASCII_ZERO '0'
-#define BAR '1'
 #define DIGITS_COUNT 10
 #define NULL_TERMINATOR '\0'
 
@@ -33,6 +35,11 @@
 #define HORIZONTAL_QUIET_ZONE_MULTIPLIER 10
 
 #define BARCODE_BUFFER_SIZE 8192
+#define MAX_BAR_RUNS ((6 * BARCODE_BUFFER_SIZE) + 2)
+#define BAR_RUN_GUARD 0x8000
+#define BAR_RUN_WIDTH_MASK 0x7FFF
+#define BATCH_BUFFER_SIZE 65536
+#define BATCH_RECORD_HEADER_SIZE 4
 
 #define MAX_DPR 4
 #define MIN_DPR 1
@@ -43,42 +50,188 @@
 
 #define CUSTOM_FONT_GLYPH_COUNT 95
 #define CUSTOM_FONT_GLYPH_SIZE 64
+#define CUSTOM_FONT_GLYPHS_SIZE (CUSTOM_FONT_GLYPH_COUNT * CUSTOM_FONT_GLYPH_SIZE * CUSTOM_FONT_GLYPH_SIZE)
+#define CUSTOM_FONT_UPLOAD_SIZE (CUSTOM_FONT_GLYPH_COUNT + CUSTOM_FONT_GLYPHS_SIZE)
+
+#define MAX_REGISTERED_FONTS 4
+#define NO_FONT (-1)
+
+/**
+ * @brief All modules share a single linear memory. Each one links its data and stack into its own slot (see
+ * --global-base in the Makefile); the pixel buffer and font storage live past the last slot and are shared. Static
+ * builds (make bar-static) link graphics.c in but import the same memory and slots.
+ */
+#define MEMORY_SLOT_SIZE 0x100000
+#define MEMORY_SLOT_COUNT 8
+#define SHARED_RUNTIME_BASE (MEMORY_SLOT_SIZE * MEMORY_SLOT_COUNT)
+#define WASM_PAGE_SIZE 0x10000
+
+/**
+ * @brief A registered font. The generation changes whenever the slot is refilled, so anything derived from the
+ * glyphs can be validated against it instead of being rebuilt on every render.
+ */
+typedef struct {
+    uint32_t generation;
+    uint8_t widths[CUSTOM_FONT_GLYPH_COUNT];
+    uint8_t glyphs[CUSTOM_FONT_GLYPHS_SIZE];
+} FontSlot;
+
+typedef struct {
+    uint32_t font_generation;
+    uint32_t next_font_slot;
+    FontSlot fonts[MAX_REGISTERED_FONTS];
+    uint8_t font_upload[CUSTOM_FONT_UPLOAD_SIZE];
+    uint32_t pixels[MAX_WIDTH * MAX_HEIGHT];
+} SharedRuntime;
+
+#ifdef BARCODE_STATS
+typedef enum {
+    STATS_STAGE_ENCODE,
+    STATS_STAGE_ERROR_CORRECTION,
+    STATS_STAGE_MASKING,
+    STATS_STAGE_RASTER,
+    STATS_STAGE_TEXT,
+    STATS_STAGE_COUNT
+} StatsStage;
+
+/**
+ * @brief Per-render counters and stage timings, laid out for direct reads from
+ * the host: all doubles first, then the 32-bit counters.
+ */
+typedef struct {
+    double total_ms;
+    double stage_ms[STATS_STAGE_COUNT];
+    uint32_t segment_passes;
+    uint32_t rs_blocks_encoded;
+    uint32_t masks_scored;
+    uint32_t fill_rect_calls;
+    uint32_t pixels_written;
+    uint32_t glyphs_drawn;
+} BarcodeStats;
+
+extern BarcodeStats stats;
+
+void stats_render_begin(void);
+void stats_render_end(void);
+void stats_stage_begin(StatsStage stage);
+void stats_stage_end(StatsStage stage);
+
+#define STATS_RENDER_BEGIN() stats_render_begin()
+#define STATS_RENDER_END() stats_render_end()
+#define STATS_STAGE_BEGIN(stage) stats_stage_begin(stage)
+#define STATS_STAGE_END(stage) stats_stage_end(stage)
+#define STATS_COUNT(field, n) (stats.field += (uint32_t)(n))
+#else
+#define STATS_RENDER_BEGIN() ((void)0)
+#define STATS_RENDER_END() ((void)0)
+#define STATS_STAGE_BEGIN(stage) ((void)0)
+#define STATS_STAGE_END(stage) ((void)0)
+#define STATS_COUNT(field, n) ((void)0)
+#endif
+
+/**
+ * @brief Result of a measure() dry run, which sizes a symbol without drawing it. Linear symbologies only fill the
+ * module count and canvas size; QR Code also reports its version (0 when the data does not fit) and bit budget.
+ */
+typedef struct {
+    int32_t version;
+    int32_t used_bits;
+    int32_t remaining_bits;
+    int32_t segments;
+    int32_t modules;
+    int32_t width;
+    int32_t height;
+} BarcodeMeasurement;
+
+/**
+ * @brief Sheet layout for render_batch(): cells of a fixed size laid out row by row, separated by a gutter.
+ */
+typedef struct {
+    int32_t cell_width;
+    int32_t cell_height;
+    int32_t gutter;
+    int32_t columns;
+} SheetLayout;
+
+/**
+ * @brief A 1D symbol as alternating bar and space widths, in the symbology's own width unit, starting with a bar.
+ * Bars flagged with BAR_RUN_GUARD extend to the guard height. Widths never share a run with the same color, so
+ * each bar is exactly one fill when emitted.
+ */
+typedef struct {
+    int count;
+    bool is_overflowed;
+    uint16_t runs[MAX_BAR_RUNS];
+} BarRunList;
+
+/**
+ * @brief A run of serial numbers in the data buffer, with the running weighted digit sum of its mod 10 checksum.
+ */
+typedef struct {
+    int len;
+    int weighted_sum;
+    int odd_pos_weight;
+    int even_pos_weight;
+} DigitSequence;
 
 #define MATH_MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MATH_MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MATH_ABS(x) ((x) < 0 ? -(x) : (x))
 
 extern char data_buffer[BARCODE_BUFFER_SIZE];
+extern uint8_t batch_buffer[BATCH_BUFFER_SIZE];
 extern int canvas_height;
 extern int canvas_width;
 extern int dpr;
 extern int symbol_buffer[BARCODE_BUFFER_SIZE];
-extern uint32_t pixels[MAX_WIDTH * MAX_HEIGHT];
-
-extern uint8_t custom_font_glyphs[CUSTOM_FONT_GLYPH_COUNT * CUSTOM_FONT_GLYPH_SIZE * CUSTOM_FONT_GLYPH_SIZE];
-extern uint8_t custom_font_widths[CUSTOM_FONT_GLYPH_COUNT];
+extern uint32_t *const pixels;
+extern BarcodeMeasurement measurement;
+extern BarRunList bar_runs;
 
 bool is_control_char(char c);
 bool is_digit(char c);
 bool is_lowercased_alpha(char c);
 bool is_uppercased_alpha(char c);
+bool load_digit_data(const char *data, int digit_count);
+bool pad_digit_data(int len, int digit_count);
+bool reserve_pixel_buffer(size_t pixel_count);
+bool reserve_render_target(const uint32_t *dest, size_t pixel_count);
 bool wasm_strncmp(const char *s1, const char *s2, int n);
+Canvas create_symbol_canvas(void);
 char digit_to_char(int d);
+const char *load_data_buffer(const char *data, int len);
+const char *load_measure_input(const char *data, int len);
 int char_to_digit(char c);
-int draw_pattern(Canvas *c, const char *const pattern, int x, int y, int module_width, int bar_height);
+int emit_bar_runs(Canvas *c, const BarRunList *list, int x, int y, int unit_px, int bar_height, int guard_height);
+int get_sequence_checksum(const DigitSequence *seq);
 int mod10_complement(const char *const data_buffer, size_t len, int odd_pos_weight, int even_pos_weight,
                      int checksum_modulo);
 int wasm_strlen(const char *s);
-void *wasm_memset(void *dest, int c, size_t n);
+WASM_IMPORT("now") double now(void);
+uint32_t advance_digit_sequence(DigitSequence *seq, int stride);
+void append_bar_bits(BarRunList *list, uint32_t bits, int module_count, bool is_guard);
+void append_bar_run(BarRunList *list, bool is_bar, int width, bool is_guard);
+void begin_digit_sequence(DigitSequence *seq, int len, int odd_pos_weight, int even_pos_weight);
+void reset_bar_runs(BarRunList *list);
 
 char *get_data_buffer(void);
 int get_height(void);
 int get_width(void);
 uint32_t *get_pixel_buffer(void);
+size_t get_pixel_capacity(void);
+const BarRunList *get_bar_runs(void);
+bool render_into(uint32_t *dest, size_t capacity);
+uint8_t *get_batch_buffer(void);
+size_t get_batch_capacity(void);
+int render_batch(const uint8_t *records, size_t records_size, int count, const SheetLayout *layout);
 void set_dpr(int user_dpr);
 
-uint8_t *get_custom_font_widths_buffer(void);
-uint8_t *get_custom_font_glyphs_buffer(void);
+uint8_t *get_font_upload_buffer(void);
+int register_font(const uint8_t *data, size_t size);
+bool set_font(int font_id);
+uint32_t get_font_generation(int font_id);
+
+void *get_stats_buffer(void);
 
 int measure_text(const char *text);
 void draw_text(Canvas *c, const char *text, int x, int y);
@@ -87,12 +240,30 @@ void draw_centered_text(Canvas *c, const char *text, int bounding_x, int boundin
 WASM_EXPORT("get_data_buffer") char *get_data_buffer(void);
 WASM_EXPORT("get_height") int get_height(void);
 WASM_EXPORT("get_pixel_buffer") uint32_t *get_pixel_buffer(void);
+WASM_EXPORT("get_pixel_capacity") size_t get_pixel_capacity(void);
+WASM_EXPORT("get_bar_runs") const BarRunList *get_bar_runs(void);
+WASM_EXPORT("render_into") bool render_into(uint32_t *dest, size_t capacity);
+WASM_EXPORT("get_batch_buffer") uint8_t *get_batch_buffer(void);
+WASM_EXPORT("get_batch_capacity") size_t get_batch_capacity(void);
+WASM_EXPORT("render_batch") int render_batch(const uint8_t *records, size_t records_size, int count,
+                                             const SheetLayout *layout);
 WASM_EXPORT("get_width") int get_width(void);
 WASM_EXPORT("set_dpr") void set_dpr(int user_dpr);
 
-WASM_EXPORT("get_custom_font_widths_buffer") uint8_t *get_custom_font_widths_buffer(void);
-WASM_EXPORT("get_custom_font_glyphs_buffer") uint8_t *get_custom_font_glyphs_buffer(void);
+WASM_EXPORT("get_font_upload_buffer") uint8_t *get_font_upload_buffer(void);
+WASM_EXPORT("register_font") int register_font(const uint8_t *data, size_t size);
+WASM_EXPORT("set_font") bool set_font(int font_id);
+WASM_EXPORT("get_font_generation") uint32_t get_font_generation(int font_id);
+
+WASM_EXPORT("get_stats_buffer") void *get_stats_buffer(void);
+
+/**
+ * @brief Validates the len bytes in data_buffer for the symbology and fits them to its input length, as the editor
+ * does before a render. Returns false when they cannot be encoded.
+ */
+extern bool normalize_data(int len);
 
+WASM_EXPORT("measure") extern const BarcodeMeasurement *measure(const char *data, int len);
 WASM_EXPORT("render") extern void render(void);
 
 #endif // BARCODE_H_
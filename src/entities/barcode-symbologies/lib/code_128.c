@@ -13,6 +13,7 @@
 
 #define CODE128_CHECKSUM_MODULO 103
 #define CODE128_MODULES_PER_SYMBOL 11
+#define CODE128_TERMINATION_BAR_MODULES 2
 
 #define CODE128_ANY_CODE_SET -1
 #define CODE128_CODE_SET_A 0
@@ -35,9 +36,16 @@
 #define CODE128_STOP 106
 
 #define CODE128_KEYWORDS_LEN 37
-#define CODE128_PATTERN_WIDTHS_LEN 107
+#define CODE128_PATTERN_BITS_LEN 107
 
+#define CODE128_KEYWORD_HASH_MULTIPLIER 0xDBBD4AE1u
+#define CODE128_KEYWORD_HASH_SHIFT 26
+#define CODE128_KEYWORD_MAX_LEN 4
+#define CODE128_KEYWORD_MIN_LEN 2
 #define CODE128_KEYWORD_NOT_FOUND -1
+#define CODE128_KEYWORD_SLOTS_LEN 64
+
+#define CODE128_MAX_INPUT_LENGTH 64
 
 typedef struct {
     const char *key;
@@ -56,26 +64,22 @@ static int curr_code_set;
 static int data_len;
 static int next_input_idx;
 static int next_symbol_idx;
+static int8_t keyword_at[BARCODE_BUFFER_SIZE];
+static int16_t digit_run_at[BARCODE_BUFFER_SIZE + 1];
 
 typedef void (*SymbolComposer)(void);
 
-static const char *const PATTERN_WIDTHS[CODE128_PATTERN_WIDTHS_LEN] = {
-    "11011001100", "11001101100", "11001100110", "10010011000", "10010001100", "10001001100", "10011001000",
-    "10011000100", "10001100100", "11001001000", "11001000100", "11000100100", "10110011100", "10011011100",
-    "10011001110", "10111001100", "10011101100", "10011100110", "11001110010", "11001011100", "11001001110",
-    "11011100100", "11001110100", "11101101110", "11101001100", "11100101100", "11100100110", "11101100100",
-    "11100110100", "11100110010", "11011011000", "11011000110", "11000110110", "10100011000", "10001011000",
-    "10001000110", "10110001000", "10001101000", "10001100010", "11010001000", "11000101000", "11000100010",
-    "10110111000", "10110001110", "10001101110", "10111011000", "10111000110", "10001110110", "11101110110",
-    "11010001110", "11000101110", "11011101000", "11011100010", "11011101110", "11101011000", "11101000110",
-    "11100010110", "11101101000", "11101100010", "11100011010", "11101111010", "11001000010", "11110001010",
-    "10100110000", "10100001100", "10010110000", "10010000110", "10000101100", "10000100110", "10110010000",
-    "10110000100", "10011010000", "10011000010", "10000110100", "10000110010", "11000010010", "11001010000",
-    "11110111010", "11000010100", "10001111010", "10100111100", "10010111100", "10010011110", "10111100100",
-    "10011110100", "10011110010", "11110100100", "11110010100", "11110010010", "11011011110", "11011110110",
-    "11110110110", "10101111000", "10100011110", "10001011110", "10111101000", "10111100010", "11110101000",
-    "11110100010", "10111011110", "10111101110", "11101011110", "11110101110", "11010000100", "11010010000",
-    "11010011100", "11000111010"};
+/**
+ * @brief Symbol patterns, one bit per module with the leftmost module in bit 10; set bits are bars.
+ */
+static const uint16_t PATTERN_BITS[CODE128_PATTERN_BITS_LEN] = {
+    0x6CC, 0x66C, 0x666, 0x498, 0x48C, 0x44C, 0x4C8, 0x4C4, 0x464, 0x648, 0x644, 0x624, 0x59C, 0x4DC, 0x4CE, 0x5CC,
+    0x4EC, 0x4E6, 0x672, 0x65C, 0x64E, 0x6E4, 0x674, 0x76E, 0x74C, 0x72C, 0x726, 0x764, 0x734, 0x732, 0x6D8, 0x6C6,
+    0x636, 0x518, 0x458, 0x446, 0x588, 0x468, 0x462, 0x688, 0x628, 0x622, 0x5B8, 0x58E, 0x46E, 0x5D8, 0x5C6, 0x476,
+    0x776, 0x68E, 0x62E, 0x6E8, 0x6E2, 0x6EE, 0x758, 0x746, 0x716, 0x768, 0x762, 0x71A, 0x77A, 0x642, 0x78A, 0x530,
+    0x50C, 0x4B0, 0x486, 0x42C, 0x426, 0x590, 0x584, 0x4D0, 0x4C2, 0x434, 0x432, 0x612, 0x650, 0x7BA, 0x614, 0x47A,
+    0x53C, 0x4BC, 0x49E, 0x5E4, 0x4F4, 0x4F2, 0x7A4, 0x794, 0x792, 0x6DE, 0x6F6, 0x7B6, 0x578, 0x51E, 0x45E, 0x5E8,
+    0x5E2, 0x7A8, 0x7A2, 0x5DE, 0x5EE, 0x75E, 0x7AE, 0x684, 0x690, 0x69C, 0x63A};
 
 static const Keyword KEYWORDS[CODE128_KEYWORDS_LEN] = {
     {"NUL",  3, 64,                     CODE128_CODE_SET_A  },
@@ -117,46 +121,73 @@ static const Keyword KEYWORDS[CODE128_KEYWORDS_LEN] = {
     {"FNC4", 4, CODE128_SENTINEL_FNC_4, CODE128_ANY_CODE_SET}
 };
 
-static inline bool is_optimizable_with_code_set_C(const char *buf, int index, int count, int total_len)
+/**
+ * @brief Perfect hash of the keywords, packed little-endian into a 32-bit word, to their index in KEYWORDS.
+ */
+static const int8_t KEYWORD_SLOTS[CODE128_KEYWORD_SLOTS_LEN] = {
+    -1, 8,  0,  36, 3,  -1, 2,  20, -1, 13, 25, 35, 27, 4,  15, 17, -1, 6,  -1, 34, 29, 31,
+    -1, -1, 24, 26, -1, 33, -1, 28, -1, -1, -1, -1, 18, -1, -1, -1, 5,  32, -1, 23, 14, -1,
+    -1, 1,  -1, 16, 30, -1, -1, -1, 19, -1, 12, 22, -1, 7,  9,  11, 21, -1, -1, 10};
+
+static inline bool is_optimizable_with_code_set_C(int index, int count)
 {
-    if (index + count > total_len)
-        return false;
-    for (int i = 0; i < count; ++i)
-        if (!is_digit(buf[index + i]))
-            return false;
-    return true;
+    return count <= digit_run_at[index];
 }
 
-static inline bool should_start_with_code_set_C(const char *buf, int total_len)
+static inline bool should_start_with_code_set_C(void)
 {
-    if (2 == total_len && is_optimizable_with_code_set_C(buf, 0, 2, total_len))
+    if (2 == data_len && is_optimizable_with_code_set_C(0, 2))
         return true;
-    if (is_optimizable_with_code_set_C(buf, 0, 4, total_len))
+    if (is_optimizable_with_code_set_C(0, 4))
         return true;
     return false;
 }
 
-static inline bool should_switch_to_code_set_C(const char *buf, int idx, int total_len)
+static inline bool should_switch_to_code_set_C(int idx)
 {
-    int remaining = total_len - idx;
-    if (is_optimizable_with_code_set_C(buf, idx, 6, total_len))
+    int remaining = data_len - idx;
+    if (is_optimizable_with_code_set_C(idx, 6))
         return true;
     if (4 == remaining || 5 == remaining)
-        if (is_optimizable_with_code_set_C(buf, idx, remaining, total_len))
+        if (is_optimizable_with_code_set_C(idx, remaining))
             return true;
     return false;
 }
 
-static inline int match_keyword(const char *data_buffer, int idx)
+/**
+ * @brief Looks up the keyword following a caret, preferring the longest one so "SOH" wins over "SO".
+ */
+static inline int lookup_keyword(const char *key)
 {
-    if (CODE128_CARET != data_buffer[idx])
-        return CODE128_KEYWORD_NOT_FOUND;
-    for (int k = 0; k < CODE128_KEYWORDS_LEN; ++k)
-        if (wasm_strncmp(&data_buffer[idx + 1], KEYWORDS[k].key, KEYWORDS[k].len))
+    uint32_t packed = 0;
+    int len = 0;
+    while (len < CODE128_KEYWORD_MAX_LEN && NULL_TERMINATOR != key[len]) {
+        packed |= (uint32_t)(uint8_t)key[len] << (8 * len);
+        ++len;
+    }
+    for (; len >= CODE128_KEYWORD_MIN_LEN; --len) {
+        uint32_t prefix = packed & (UINT32_MAX >> (8 * (CODE128_KEYWORD_MAX_LEN - len)));
+        int k = KEYWORD_SLOTS[(prefix * CODE128_KEYWORD_HASH_MULTIPLIER) >> CODE128_KEYWORD_HASH_SHIFT];
+        if (CODE128_KEYWORD_NOT_FOUND != k && len == KEYWORDS[k].len && wasm_strncmp(key, KEYWORDS[k].key, len))
             return k;
+    }
     return CODE128_KEYWORD_NOT_FOUND;
 }
 
+/**
+ * @brief Classifies the input once per encode: the keyword at each caret and the length of the digit run starting
+ * at each position, so neither the initial code set choice nor the composers rescan the input.
+ */
+static inline void tokenize_input(void)
+{
+    digit_run_at[data_len] = 0;
+    for (int i = data_len - 1; 0 <= i; --i) {
+        char c = data_buffer[i];
+        digit_run_at[i] = is_digit(c) ? (int16_t)(digit_run_at[i + 1] + 1) : 0;
+        keyword_at[i] = (int8_t)(CODE128_CARET == c ? lookup_keyword(&data_buffer[i + 1]) : CODE128_KEYWORD_NOT_FOUND);
+    }
+}
+
 static inline void switch_code_set(int new_subset, int symbol)
 {
     symbol_buffer[next_symbol_idx++] = symbol;
@@ -195,7 +226,7 @@ static inline void handle_keyword_value(int value)
 
 static inline bool parse_keyword(void)
 {
-    int keyword_idx = match_keyword(data_buffer, next_input_idx);
+    int keyword_idx = keyword_at[next_input_idx];
     if (CODE128_KEYWORD_NOT_FOUND == keyword_idx)
         return false;
     Keyword keyword = KEYWORDS[keyword_idx];
@@ -232,7 +263,7 @@ static inline bool handle_common_composition_preamble(int *idx)
     if (parse_keyword())
         return true;
     *idx = next_input_idx;
-    if (should_switch_to_code_set_C(data_buffer, *idx, data_len)) {
+    if (should_switch_to_code_set_C(*idx)) {
         switch_code_set(CODE128_CODE_SET_C, CODE128_CODE_C);
         return true;
     }
@@ -316,7 +347,7 @@ static inline void compose_code_set_C(void)
     if (parse_keyword())
         return;
     int idx = next_input_idx;
-    if (!is_optimizable_with_code_set_C(data_buffer, idx, 2, data_len)) {
+    if (!is_optimizable_with_code_set_C(idx, 2)) {
         char c = data_buffer[idx];
         if (is_control_char(c))
             switch_code_set(CODE128_CODE_SET_A, CODE128_CODE_A);
@@ -342,9 +373,9 @@ static const SymbolComposer code_set_composers[] = {compose_code_set_A, compose_
 
 static inline int determine_initial_code_set(void)
 {
-    if (should_start_with_code_set_C(data_buffer, data_len))
+    if (should_start_with_code_set_C())
         return CODE128_CODE_SET_C;
-    int keyword_idx = match_keyword(data_buffer, 0);
+    int keyword_idx = 0 < data_len ? keyword_at[0] : CODE128_KEYWORD_NOT_FOUND;
     if (CODE128_KEYWORD_NOT_FOUND != keyword_idx) {
         if (CODE128_CODE_SET_A == KEYWORDS[keyword_idx].dest_code_set)
             return CODE128_CODE_SET_A;
@@ -354,34 +385,92 @@ static inline int determine_initial_code_set(void)
     return CODE128_CODE_SET_B;
 }
 
-void render(void)
+static inline void encode_symbols(void)
 {
-    int module_width_px = BASE_MODULE_WIDTH_PX * dpr;
-    int bar_height_px = BASE_BAR_HEIGHT_PX * dpr;
-    int horizontal_quiet_zone_px = HORIZONTAL_QUIET_ZONE_MULTIPLIER * module_width_px;
     data_len = wasm_strlen(data_buffer);
+    tokenize_input();
     next_symbol_idx = 0;
     next_input_idx = 0;
     curr_code_set = determine_initial_code_set();
     switch_code_set(curr_code_set, CODE128_START_A + curr_code_set);
     while (next_input_idx < data_len)
         code_set_composers[curr_code_set]();
-    symbol_buffer[next_symbol_idx++] = compose_checksum();
+    int checksum = compose_checksum();
+    symbol_buffer[next_symbol_idx++] = checksum;
     symbol_buffer[next_symbol_idx++] = CODE128_STOP;
-    int total_modules = (next_symbol_idx * CODE128_MODULES_PER_SYMBOL) + 2;
-    int text_bounding_height = SYMBOL_TEXT_BOUNDING_HEIGHT * dpr;
+}
+
+static inline int get_total_modules(void)
+{
+    return (next_symbol_idx * CODE128_MODULES_PER_SYMBOL) + CODE128_TERMINATION_BAR_MODULES;
+}
+
+static inline void compose_bar_runs(void)
+{
+    reset_bar_runs(&bar_runs);
+    for (int i = 0; i < next_symbol_idx; ++i)
+        append_bar_bits(&bar_runs, PATTERN_BITS[symbol_buffer[i]], CODE128_MODULES_PER_SYMBOL, false);
+    append_bar_run(&bar_runs, true, CODE128_TERMINATION_BAR_MODULES, false);
+}
+
+static inline int get_symbol_width(int total_modules)
+{
+    int module_width_px = BASE_MODULE_WIDTH_PX * dpr;
+    return (total_modules * module_width_px) + (2 * HORIZONTAL_QUIET_ZONE_MULTIPLIER * module_width_px);
+}
+
+static inline int get_symbol_height(void)
+{
+    int content_height = (BASE_BAR_HEIGHT_PX + SYMBOL_TEXT_PADDING_TOP_Y + SYMBOL_TEXT_BOUNDING_HEIGHT) * dpr;
+    return (2 * BASE_VERTICAL_QUIET_ZONE_PX * dpr) + content_height;
+}
+
+/**
+ * @brief Accepts ASCII only and truncates it to CODE128_MAX_INPUT_LENGTH characters.
+ */
+bool normalize_data(int len)
+{
+    for (int i = 0; i < len; ++i)
+        if ((uint8_t)data_buffer[i] > CODE128_ASCII_DEL)
+            return false;
+    data_buffer[MATH_MIN(len, CODE128_MAX_INPUT_LENGTH)] = NULL_TERMINATOR;
+    return true;
+}
+
+const BarcodeMeasurement *measure(const char *data, int len)
+{
+    load_measure_input(data, len);
+    encode_symbols();
+    int total_modules = get_total_modules();
+    measurement.modules = total_modules;
+    measurement.width = get_symbol_width(total_modules);
+    measurement.height = get_symbol_height();
+    return &measurement;
+}
+
+void render(void)
+{
+    int module_width_px = BASE_MODULE_WIDTH_PX * dpr;
+    int bar_height_px = BASE_BAR_HEIGHT_PX * dpr;
+    int horizontal_quiet_zone_px = HORIZONTAL_QUIET_ZONE_MULTIPLIER * module_width_px;
+    STATS_RENDER_BEGIN();
+    STATS_STAGE_BEGIN(STATS_STAGE_ENCODE);
+    encode_symbols();
+    compose_bar_runs();
+    STATS_STAGE_END(STATS_STAGE_ENCODE);
     int padding_top = SYMBOL_TEXT_PADDING_TOP_Y * dpr;
     int quiet_zone = BASE_VERTICAL_QUIET_ZONE_PX * dpr;
-    int content_height = bar_height_px + padding_top + text_bounding_height;
-    canvas_width = (total_modules * module_width_px) + (2 * horizontal_quiet_zone_px);
-    canvas_height = quiet_zone + content_height + quiet_zone;
-    Canvas c = canvas_create(pixels, canvas_width, canvas_height);
+    canvas_width = get_symbol_width(get_total_modules());
+    canvas_height = get_symbol_height();
+    STATS_STAGE_BEGIN(STATS_STAGE_RASTER);
+    Canvas c = create_symbol_canvas();
     canvas_fill_rect(&c, 0, 0, canvas_width, canvas_height, C_WHITE);
-    int curr_x = horizontal_quiet_zone_px;
     int curr_y = quiet_zone;
-    for (int i = 0; i < next_symbol_idx; ++i)
-        curr_x += draw_pattern(&c, PATTERN_WIDTHS[symbol_buffer[i]], curr_x, curr_y, module_width_px, bar_height_px);
-    canvas_fill_rect(&c, curr_x, curr_y, 2 * module_width_px, bar_height_px, C_BLACK);
+    emit_bar_runs(&c, &bar_runs, horizontal_quiet_zone_px, curr_y, module_width_px, bar_height_px, bar_height_px);
+    STATS_STAGE_END(STATS_STAGE_RASTER);
+    STATS_STAGE_BEGIN(STATS_STAGE_TEXT);
     int text_y = curr_y + bar_height_px + padding_top;
     draw_centered_text(&c, data_buffer, 0, canvas_width, text_y);
+    STATS_STAGE_END(STATS_STAGE_TEXT);
+    STATS_RENDER_END();
 }
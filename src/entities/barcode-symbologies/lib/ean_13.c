@@ -7,12 +7,9 @@
 #define EAN13_ENC_L 0
 #define EAN13_ENC_G 1
 #define EAN13_ENC_R 2
-#define EAN13_ENC_G_CHAR 'G'
-#define EAN13_ENC_L_CHAR 'L'
 
-#define EAN13_MARKER_START "101"
-#define EAN13_MARKER_CENTER "01010"
-#define EAN13_MARKER_END "101"
+#define EAN13_MARKER_SIDE_BITS 0x5
+#define EAN13_MARKER_CENTER_BITS 0x0A
 
 #define EAN13_EVEN_POS_WEIGHT 1
 #define EAN13_ODD_POS_WEIGHT 3
@@ -22,112 +19,245 @@
 #define EAN13_GROUP_LEN 6
 #define EAN13_TOTAL_MODULES 95
 
+#define EAN13_DIGIT_MODULES 7
+#define EAN13_CENTER_MARKER_MODULES 5
+#define EAN13_SIDE_MARKER_MODULES 3
+#define EAN13_GROUP_MODULES (EAN13_GROUP_LEN * EAN13_DIGIT_MODULES)
+
 #define EAN13_MARKER_EXTRA_HEIGHT_SCALAR 0.15f
 
-static const char *const PARITY_PATTERNS[DIGITS_COUNT] = {"LLLLLL", "LLGLGG", "LLGGLG", "LLGGGL", "LGLLGG",
-                                                          "LGGLLG", "LGGGLL", "LGLGLG", "LGLGGL", "LGGLGL"};
-
-static const char *const ENCODING_TABLE[DIGITS_COUNT][EAN13_ENCODING_TYPES_COUNT] = {
-    {"0001101", "0100111", "1110010"},
-    {"0011001", "0110011", "1100110"},
-    {"0010011", "0011011", "1101100"},
-    {"0111101", "0100001", "1000010"},
-    {"0100011", "0011101", "1011100"},
-    {"0110001", "0111001", "1001110"},
-    {"0101111", "0000101", "1010000"},
-    {"0111011", "0010001", "1000100"},
-    {"0110111", "0001001", "1001000"},
-    {"0001011", "0010111", "1110100"}
+/**
+ * @brief Left-group parities by first digit, leftmost digit in bit 5; set bits select the G (even) encoding.
+ */
+static const uint8_t PARITY_BITS[DIGITS_COUNT] = {0x00, 0x0B, 0x0D, 0x0E, 0x13, 0x19, 0x1C, 0x15, 0x16, 0x1A};
+
+/**
+ * @brief Digit patterns per encoding, one bit per module with the leftmost module in bit 6; set bits are bars.
+ */
+static const uint8_t ENCODING_BITS[DIGITS_COUNT][EAN13_ENCODING_TYPES_COUNT] = {
+    {0x0D, 0x27, 0x72},
+    {0x19, 0x33, 0x66},
+    {0x13, 0x1B, 0x6C},
+    {0x3D, 0x21, 0x42},
+    {0x23, 0x1D, 0x5C},
+    {0x31, 0x39, 0x4E},
+    {0x2F, 0x05, 0x50},
+    {0x3B, 0x11, 0x44},
+    {0x37, 0x09, 0x48},
+    {0x0B, 0x17, 0x74}
 };
 
 typedef struct {
-    Canvas *c;
-    int y;
     int module_width;
     int bar_height;
-} Ean13Context;
+    int marker_bar_height;
+    int start_marker_x;
+    int bars_y;
+    int group_width;
+    int left_group_x;
+    int right_group_x;
+    int text_y;
+} Ean13Layout;
 
-typedef struct {
-    size_t start_index;
-    size_t end_index;
-    const char *parity_pattern;
-} GroupConfig;
+/**
+ * @brief Module pattern of the digit at position (1-12); the left group's parities follow the leading digit.
+ */
+static inline uint8_t get_digit_bits(int position)
+{
+    int digit = char_to_digit(data_buffer[position]);
+    if (position > EAN13_GROUP_LEN)
+        return ENCODING_BITS[digit][EAN13_ENC_R];
+    uint8_t parity_bits = PARITY_BITS[char_to_digit(data_buffer[0])];
+    bool is_even_parity = 0 != (parity_bits & (1u << (EAN13_GROUP_LEN - position)));
+    return ENCODING_BITS[digit][is_even_parity ? EAN13_ENC_G : EAN13_ENC_L];
+}
 
-static inline int get_integer_encoding_type(char c)
+static inline void append_group(int first_position)
 {
-    if (EAN13_ENC_L_CHAR == c)
-        return EAN13_ENC_L;
-    if (EAN13_ENC_G_CHAR == c)
-        return EAN13_ENC_G;
-    return EAN13_ENC_R;
+    for (int position = first_position; position < first_position + EAN13_GROUP_LEN; ++position)
+        append_bar_bits(&bar_runs, get_digit_bits(position), EAN13_DIGIT_MODULES, false);
 }
 
-static inline int draw_group(const Ean13Context *ctx, int x, GroupConfig cfg)
+static inline void compose_bar_runs(void)
 {
-    int curr_x_offset = 0;
-    const char *code = NULL;
-    for (size_t i = cfg.start_index; i <= cfg.end_index; ++i) {
-        int digit = char_to_digit(data_buffer[i]);
-        int encoding_idx = EAN13_ENC_R;
-        if (NULL != cfg.parity_pattern)
-            encoding_idx = get_integer_encoding_type(cfg.parity_pattern[i - cfg.start_index]);
-        code = ENCODING_TABLE[digit][encoding_idx];
-        curr_x_offset += draw_pattern(ctx->c, code, x + curr_x_offset, ctx->y, ctx->module_width, ctx->bar_height);
-    }
-    return curr_x_offset;
+    reset_bar_runs(&bar_runs);
+    append_bar_bits(&bar_runs, EAN13_MARKER_SIDE_BITS, EAN13_SIDE_MARKER_MODULES, true);
+    append_group(1);
+    append_bar_bits(&bar_runs, EAN13_MARKER_CENTER_BITS, EAN13_CENTER_MARKER_MODULES, true);
+    append_group(EAN13_GROUP_LEN + 1);
+    append_bar_bits(&bar_runs, EAN13_MARKER_SIDE_BITS, EAN13_SIDE_MARKER_MODULES, true);
 }
 
 static void extract_text_segment(char *dest, size_t start, size_t len)
 {
-    for (size_t i = 0; i < len; ++i)
-        dest[i] = data_buffer[start + i];
+    rt_copy(dest, data_buffer + start, len);
     dest[len] = '\0';
 }
 
-void render(void)
+static inline int get_marker_bar_height(int regular_bar_height_px)
+{
+    int marker_extra_height = (int)(((float)regular_bar_height_px * EAN13_MARKER_EXTRA_HEIGHT_SCALAR) + 0.5f);
+    return regular_bar_height_px + marker_extra_height;
+}
+
+static inline int get_symbol_width(void)
 {
     int module_width_px = BASE_MODULE_WIDTH_PX * dpr;
+    return (EAN13_TOTAL_MODULES * module_width_px) + (2 * HORIZONTAL_QUIET_ZONE_MULTIPLIER * module_width_px);
+}
+
+static inline int get_symbol_height(void)
+{
     int regular_bar_height_px = BASE_BAR_HEIGHT_PX * dpr;
-    int marker_extra_height = (int)(((float)regular_bar_height_px * EAN13_MARKER_EXTRA_HEIGHT_SCALAR) + 0.5f);
-    int marker_bar_height_px = regular_bar_height_px + marker_extra_height;
-    int horizontal_quiet_zone_px = HORIZONTAL_QUIET_ZONE_MULTIPLIER * module_width_px;
-    int text_bounding_height = SYMBOL_TEXT_BOUNDING_HEIGHT * dpr;
-    int padding_top = SYMBOL_TEXT_PADDING_TOP_Y * dpr;
-    int quiet_zone = BASE_VERTICAL_QUIET_ZONE_PX * dpr;
-    int max_content_height = MATH_MAX(marker_bar_height_px, regular_bar_height_px + padding_top + text_bounding_height);
-    canvas_width = (EAN13_TOTAL_MODULES * module_width_px) + (2 * horizontal_quiet_zone_px);
-    canvas_height = quiet_zone + max_content_height + quiet_zone;
-    Canvas c = canvas_create(pixels, canvas_width, canvas_height);
+    int text_height = (SYMBOL_TEXT_PADDING_TOP_Y + SYMBOL_TEXT_BOUNDING_HEIGHT) * dpr;
+    int max_content_height =
+        MATH_MAX(get_marker_bar_height(regular_bar_height_px), regular_bar_height_px + text_height);
+    return (2 * BASE_VERTICAL_QUIET_ZONE_PX * dpr) + max_content_height;
+}
+
+static inline Ean13Layout get_layout(void)
+{
+    int module_width = BASE_MODULE_WIDTH_PX * dpr;
+    int bar_height = BASE_BAR_HEIGHT_PX * dpr;
+    int start_marker_x = HORIZONTAL_QUIET_ZONE_MULTIPLIER * module_width;
+    int bars_y = BASE_VERTICAL_QUIET_ZONE_PX * dpr;
+    int group_width = EAN13_GROUP_MODULES * module_width;
+    int left_group_x = start_marker_x + (EAN13_SIDE_MARKER_MODULES * module_width);
+    return (Ean13Layout){.module_width = module_width,
+                         .bar_height = bar_height,
+                         .marker_bar_height = get_marker_bar_height(bar_height),
+                         .start_marker_x = start_marker_x,
+                         .bars_y = bars_y,
+                         .group_width = group_width,
+                         .left_group_x = left_group_x,
+                         .right_group_x = left_group_x + group_width + (EAN13_CENTER_MARKER_MODULES * module_width),
+                         .text_y = bars_y + bar_height + (SYMBOL_TEXT_PADDING_TOP_Y * dpr)};
+}
+
+static inline int get_digit_x(const Ean13Layout *layout, int position)
+{
+    if (position > EAN13_GROUP_LEN)
+        return layout->right_group_x + ((position - EAN13_GROUP_LEN - 1) * EAN13_DIGIT_MODULES * layout->module_width);
+    return layout->left_group_x + ((position - 1) * EAN13_DIGIT_MODULES * layout->module_width);
+}
+
+static inline void draw_group_text(Canvas *c, const Ean13Layout *layout, int first_position)
+{
+    char segment[EAN13_GROUP_LEN + 1];
+    extract_text_segment(segment, (size_t)first_position, EAN13_GROUP_LEN);
+    int group_x = first_position > EAN13_GROUP_LEN ? layout->right_group_x : layout->left_group_x;
+    draw_centered_text(c, segment, group_x, layout->group_width, layout->text_y);
+}
+
+/**
+ * @brief Keeps the 12 data digits; render() appends the check digit.
+ */
+bool normalize_data(int len)
+{
+    return pad_digit_data(len, EAN13_CHECKSUM_INDEX);
+}
+
+const BarcodeMeasurement *measure(const char *data, int len)
+{
+    load_measure_input(data, len);
+    measurement.modules = EAN13_TOTAL_MODULES;
+    measurement.width = get_symbol_width();
+    measurement.height = get_symbol_height();
+    return &measurement;
+}
+
+void render(void)
+{
+    Ean13Layout layout = get_layout();
+    canvas_width = get_symbol_width();
+    canvas_height = get_symbol_height();
+    STATS_RENDER_BEGIN();
+    STATS_STAGE_BEGIN(STATS_STAGE_RASTER);
+    Canvas c = create_symbol_canvas();
     canvas_fill_rect(&c, 0, 0, canvas_width, canvas_height, C_WHITE);
+    STATS_STAGE_END(STATS_STAGE_RASTER);
+    STATS_STAGE_BEGIN(STATS_STAGE_ENCODE);
     int checksum = mod10_complement(data_buffer, EAN13_CHECKSUM_INDEX, EAN13_ODD_POS_WEIGHT, EAN13_EVEN_POS_WEIGHT,
                                     EAN13_CHECKSUM_MODULO);
     data_buffer[EAN13_CHECKSUM_INDEX] = digit_to_char(checksum);
-    int curr_x = horizontal_quiet_zone_px;
-    int curr_y = quiet_zone;
-    int first_digit = char_to_digit(data_buffer[0]);
-    const char *const parity_pattern = PARITY_PATTERNS[first_digit];
-    Ean13Context ctx = {.c = &c, .y = curr_y, .module_width = module_width_px, .bar_height = regular_bar_height_px};
-    int start_marker_x = curr_x;
-    curr_x += draw_pattern(&c, EAN13_MARKER_START, curr_x, curr_y, module_width_px, marker_bar_height_px);
-    int left_group_start_x = curr_x;
-    GroupConfig left_group = {1, EAN13_GROUP_LEN, parity_pattern};
-    curr_x += draw_group(&ctx, curr_x, left_group);
-    int left_group_width = curr_x - left_group_start_x;
-    curr_x += draw_pattern(&c, EAN13_MARKER_CENTER, curr_x, curr_y, module_width_px, marker_bar_height_px);
-    int right_group_start_x = curr_x;
-    GroupConfig right_group = {EAN13_GROUP_LEN + 1, (EAN13_GROUP_LEN * 2) - 1, NULL};
-    curr_x += draw_group(&ctx, curr_x, right_group);
-    curr_x +=
-        draw_pattern(&c, ENCODING_TABLE[checksum][EAN13_ENC_R], curr_x, curr_y, module_width_px, regular_bar_height_px);
-    int right_group_width = curr_x - right_group_start_x;
-    curr_x += draw_pattern(&c, EAN13_MARKER_END, curr_x, curr_y, module_width_px, marker_bar_height_px);
-    int text_y = curr_y + regular_bar_height_px + padding_top;
-    char segment[EAN13_GROUP_LEN + 1];
+    compose_bar_runs();
+    STATS_STAGE_END(STATS_STAGE_ENCODE);
+    STATS_STAGE_BEGIN(STATS_STAGE_RASTER);
+    emit_bar_runs(&c, &bar_runs, layout.start_marker_x, layout.bars_y, layout.module_width, layout.bar_height,
+                  layout.marker_bar_height);
+    STATS_STAGE_END(STATS_STAGE_RASTER);
+    STATS_STAGE_BEGIN(STATS_STAGE_TEXT);
+    char segment[2];
     extract_text_segment(segment, 0, 1);
     int segment_width = measure_text(segment);
-    draw_text(&c, segment, start_marker_x - segment_width - (2 * module_width_px), text_y);
-    extract_text_segment(segment, 1, EAN13_GROUP_LEN);
-    draw_centered_text(&c, segment, left_group_start_x, left_group_width, text_y);
-    extract_text_segment(segment, EAN13_GROUP_LEN + 1, EAN13_GROUP_LEN);
-    draw_centered_text(&c, segment, right_group_start_x, right_group_width, text_y);
+    draw_text(&c, segment, layout.start_marker_x - segment_width - (2 * layout.module_width), layout.text_y);
+    draw_group_text(&c, &layout, 1);
+    draw_group_text(&c, &layout, EAN13_GROUP_LEN + 1);
+    STATS_STAGE_END(STATS_STAGE_TEXT);
+    STATS_RENDER_END();
+}
+
+/**
+ * @brief Redraws only the digits in changed (bit i for position i) over a copy of the previous frame, and the text
+ * of each group they fall in. A change to the leading digit re-parities the whole left group, so it needs render().
+ */
+static void redraw_changed_digits(Canvas *c, const Ean13Layout *layout, uint32_t changed)
+{
+    bool is_group_changed[2] = {false, false};
+    for (int position = 1; position <= EAN13_CHECKSUM_INDEX; ++position) {
+        if (0 == (changed & (1u << position)))
+            continue;
+        int x = get_digit_x(layout, position);
+        canvas_fill_rect(c, x, layout->bars_y, EAN13_DIGIT_MODULES * layout->module_width, layout->bar_height,
+                         C_WHITE);
+        reset_bar_runs(&bar_runs);
+        append_bar_bits(&bar_runs, get_digit_bits(position), EAN13_DIGIT_MODULES, false);
+        emit_bar_runs(c, &bar_runs, x, layout->bars_y, layout->module_width, layout->bar_height, layout->bar_height);
+        is_group_changed[position > EAN13_GROUP_LEN] = true;
+    }
+    for (int group = 0; group < 2; ++group) {
+        if (!is_group_changed[group])
+            continue;
+        int group_x = 0 == group ? layout->left_group_x : layout->right_group_x;
+        canvas_fill_rect(c, group_x, layout->text_y, layout->group_width, canvas_height - layout->text_y, C_WHITE);
+        draw_group_text(c, layout, 1 + (group * EAN13_GROUP_LEN));
+    }
+}
+
+/**
+ * @brief Renders count consecutive serials, start, start + stride, ..., back to back into dest (capacity pixels).
+ * start holds the 12 digits before the check digit; anything else renders nothing. Each frame after the first
+ * starts as a copy of the previous one; only the digits, checksum and text that changed are redrawn, and the
+ * checksum is updated from the changed digits alone. Returns the number of frames written.
+ */
+WASM_EXPORT("render_sequence")
+int render_sequence(const char *start, int count, int stride, uint32_t *dest, size_t capacity)
+{
+    if (NULL == dest || count <= 0 || stride < 0 || !load_digit_data(start, EAN13_CHECKSUM_INDEX))
+        return 0;
+    Ean13Layout layout = get_layout();
+    canvas_width = get_symbol_width();
+    canvas_height = get_symbol_height();
+    size_t frame_pixels = (size_t)canvas_width * (size_t)canvas_height;
+    count = (int)MATH_MIN((size_t)count, capacity / frame_pixels);
+    if (0 == count || !reserve_render_target(dest, frame_pixels * (size_t)count) || !render_into(dest, frame_pixels))
+        return 0;
+    DigitSequence seq;
+    begin_digit_sequence(&seq, EAN13_CHECKSUM_INDEX, EAN13_ODD_POS_WEIGHT, EAN13_EVEN_POS_WEIGHT);
+    for (int i = 1; i < count; ++i) {
+        uint32_t *frame = dest + ((size_t)i * frame_pixels);
+        uint32_t changed = advance_digit_sequence(&seq, stride);
+        char checksum = digit_to_char(get_sequence_checksum(&seq));
+        if (checksum != data_buffer[EAN13_CHECKSUM_INDEX])
+            changed |= 1u << EAN13_CHECKSUM_INDEX;
+        data_buffer[EAN13_CHECKSUM_INDEX] = checksum;
+        if (0 != (changed & 1u)) {
+            render_into(frame, frame_pixels);
+            continue;
+        }
+        rt_copy(frame, frame - frame_pixels, frame_pixels * sizeof(uint32_t));
+        Canvas c = canvas_create(frame, canvas_width, canvas_height);
+        redraw_changed_digits(&c, &layout, changed);
+    }
+    return count;
 }
@@ -4,9 +4,6 @@
 #include "barcode.h"
 #include "graphics.h"
 
-#define ITF14_BINARY_BAR "1"
-#define ITF14_WIDE_CHAR 'W'
-
 #define ITF14_NARROW_BAR_BASE 4
 #define ITF14_NARROW_SPACE_BASE 5
 #define ITF14_WIDE_BAR_BASE 11
@@ -18,100 +15,333 @@
 #define ITF14_ODD_POS_WEIGHT 3
 #define ITF14_START_INDEX 0
 #define ITF14_WIDTHS_PER_DIGIT 5
+#define ITF14_ELEMENT_COUNT (4 + (2 * 7 * ITF14_WIDTHS_PER_DIGIT) + 3)
+#define ITF14_DIGIT_PAIRS 100
+#define ITF14_RUNS_PER_PAIR (2 * ITF14_WIDTHS_PER_DIGIT)
 
-#define ITF14_RESOLVE_WIDTH(pattern_char, wide_width, narrow_width)                                                    \
-    ((ITF14_WIDE_CHAR == (pattern_char)) ? (wide_width) : (narrow_width))
+#define ITF14_BEARER_BAR_BASE (5 * ITF14_NARROW_BAR_BASE)
 
-static const char *const WIDTHS[DIGITS_COUNT] = {"nnWWn", "WnnnW", "nWnnW", "WWnnn", "nnWnW",
-                                                 "WnWnn", "nWWnn", "nnnWW", "WnnWn", "nWnWn"};
+#define NB ITF14_NARROW_BAR_BASE
+#define NS ITF14_NARROW_SPACE_BASE
+#define WB ITF14_WIDE_BAR_BASE
+#define WS ITF14_WIDE_SPACE_BASE
 
-typedef struct {
-    Canvas *c;
-    int y;
-    int height;
-    int narrow_bar;
-    int narrow_space;
-    int wide_bar;
-    int wide_space;
-} Itf14Context;
-
-static inline int draw_start_pattern(const Itf14Context *ctx, int x)
+/**
+ * @brief Bar and space widths, in base pixels, of every digit pair: the first digit's elements are the bars and the
+ * second's the spaces, interleaved starting with a bar.
+ */
+static const uint8_t PAIR_RUNS[ITF14_DIGIT_PAIRS][ITF14_RUNS_PER_PAIR] = {
+    {NB, NS, NB, NS, WB, WS, WB, WS, NB, NS}, /* 00 */
+    {NB, WS, NB, NS, WB, NS, WB, NS, NB, WS}, /* 01 */
+    {NB, NS, NB, WS, WB, NS, WB, NS, NB, WS}, /* 02 */
+    {NB, WS, NB, WS, WB, NS, WB, NS, NB, NS}, /* 03 */
+    {NB, NS, NB, NS, WB, WS, WB, NS, NB, WS}, /* 04 */
+    {NB, WS, NB, NS, WB, WS, WB, NS, NB, NS}, /* 05 */
+    {NB, NS, NB, WS, WB, WS, WB, NS, NB, NS}, /* 06 */
+    {NB, NS, NB, NS, WB, NS, WB, WS, NB, WS}, /* 07 */
+    {NB, WS, NB, NS, WB, NS, WB, WS, NB, NS}, /* 08 */
+    {NB, NS, NB, WS, WB, NS, WB, WS, NB, NS}, /* 09 */
+    {WB, NS, NB, NS, NB, WS, NB, WS, WB, NS}, /* 10 */
+    {WB, WS, NB, NS, NB, NS, NB, NS, WB, WS}, /* 11 */
+    {WB, NS, NB, WS, NB, NS, NB, NS, WB, WS}, /* 12 */
+    {WB, WS, NB, WS, NB, NS, NB, NS, WB, NS}, /* 13 */
+    {WB, NS, NB, NS, NB, WS, NB, NS, WB, WS}, /* 14 */
+    {WB, WS, NB, NS, NB, WS, NB, NS, WB, NS}, /* 15 */
+    {WB, NS, NB, WS, NB, WS, NB, NS, WB, NS}, /* 16 */
+    {WB, NS, NB, NS, NB, NS, NB, WS, WB, WS}, /* 17 */
+    {WB, WS, NB, NS, NB, NS, NB, WS, WB, NS}, /* 18 */
+    {WB, NS, NB, WS, NB, NS, NB, WS, WB, NS}, /* 19 */
+    {NB, NS, WB, NS, NB, WS, NB, WS, WB, NS}, /* 20 */
+    {NB, WS, WB, NS, NB, NS, NB, NS, WB, WS}, /* 21 */
+    {NB, NS, WB, WS, NB, NS, NB, NS, WB, WS}, /* 22 */
+    {NB, WS, WB, WS, NB, NS, NB, NS, WB, NS}, /* 23 */
+    {NB, NS, WB, NS, NB, WS, NB, NS, WB, WS}, /* 24 */
+    {NB, WS, WB, NS, NB, WS, NB, NS, WB, NS}, /* 25 */
+    {NB, NS, WB, WS, NB, WS, NB, NS, WB, NS}, /* 26 */
+    {NB, NS, WB, NS, NB, NS, NB, WS, WB, WS}, /* 27 */
+    {NB, WS, WB, NS, NB, NS, NB, WS, WB, NS}, /* 28 */
+    {NB, NS, WB, WS, NB, NS, NB, WS, WB, NS}, /* 29 */
+    {WB, NS, WB, NS, NB, WS, NB, WS, NB, NS}, /* 30 */
+    {WB, WS, WB, NS, NB, NS, NB, NS, NB, WS}, /* 31 */
+    {WB, NS, WB, WS, NB, NS, NB, NS, NB, WS}, /* 32 */
+    {WB, WS, WB, WS, NB, NS, NB, NS, NB, NS}, /* 33 */
+    {WB, NS, WB, NS, NB, WS, NB, NS, NB, WS}, /* 34 */
+    {WB, WS, WB, NS, NB, WS, NB, NS, NB, NS}, /* 35 */
+    {WB, NS, WB, WS, NB, WS, NB, NS, NB, NS}, /* 36 */
+    {WB, NS, WB, NS, NB, NS, NB, WS, NB, WS}, /* 37 */
+    {WB, WS, WB, NS, NB, NS, NB, WS, NB, NS}, /* 38 */
+    {WB, NS, WB, WS, NB, NS, NB, WS, NB, NS}, /* 39 */
+    {NB, NS, NB, NS, WB, WS, NB, WS, WB, NS}, /* 40 */
+    {NB, WS, NB, NS, WB, NS, NB, NS, WB, WS}, /* 41 */
+    {NB, NS, NB, WS, WB, NS, NB, NS, WB, WS}, /* 42 */
+    {NB, WS, NB, WS, WB, NS, NB, NS, WB, NS}, /* 43 */
+    {NB, NS, NB, NS, WB, WS, NB, NS, WB, WS}, /* 44 */
+    {NB, WS, NB, NS, WB, WS, NB, NS, WB, NS}, /* 45 */
+    {NB, NS, NB, WS, WB, WS, NB, NS, WB, NS}, /* 46 */
+    {NB, NS, NB, NS, WB, NS, NB, WS, WB, WS}, /* 47 */
+    {NB, WS, NB, NS, WB, NS, NB, WS, WB, NS}, /* 48 */
+    {NB, NS, NB, WS, WB, NS, NB, WS, WB, NS}, /* 49 */
+    {WB, NS, NB, NS, WB, WS, NB, WS, NB, NS}, /* 50 */
+    {WB, WS, NB, NS, WB, NS, NB, NS, NB, WS}, /* 51 */
+    {WB, NS, NB, WS, WB, NS, NB, NS, NB, WS}, /* 52 */
+    {WB, WS, NB, WS, WB, NS, NB, NS, NB, NS}, /* 53 */
+    {WB, NS, NB, NS, WB, WS, NB, NS, NB, WS}, /* 54 */
+    {WB, WS, NB, NS, WB, WS, NB, NS, NB, NS}, /* 55 */
+    {WB, NS, NB, WS, WB, WS, NB, NS, NB, NS}, /* 56 */
+    {WB, NS, NB, NS, WB, NS, NB, WS, NB, WS}, /* 57 */
+    {WB, WS, NB, NS, WB, NS, NB, WS, NB, NS}, /* 58 */
+    {WB, NS, NB, WS, WB, NS, NB, WS, NB, NS}, /* 59 */
+    {NB, NS, WB, NS, WB, WS, NB, WS, NB, NS}, /* 60 */
+    {NB, WS, WB, NS, WB, NS, NB, NS, NB, WS}, /* 61 */
+    {NB, NS, WB, WS, WB, NS, NB, NS, NB, WS}, /* 62 */
+    {NB, WS, WB, WS, WB, NS, NB, NS, NB, NS}, /* 63 */
+    {NB, NS, WB, NS, WB, WS, NB, NS, NB, WS}, /* 64 */
+    {NB, WS, WB, NS, WB, WS, NB, NS, NB, NS}, /* 65 */
+    {NB, NS, WB, WS, WB, WS, NB, NS, NB, NS}, /* 66 */
+    {NB, NS, WB, NS, WB, NS, NB, WS, NB, WS}, /* 67 */
+    {NB, WS, WB, NS, WB, NS, NB, WS, NB, NS}, /* 68 */
+    {NB, NS, WB, WS, WB, NS, NB, WS, NB, NS}, /* 69 */
+    {NB, NS, NB, NS, NB, WS, WB, WS, WB, NS}, /* 70 */
+    {NB, WS, NB, NS, NB, NS, WB, NS, WB, WS}, /* 71 */
+    {NB, NS, NB, WS, NB, NS, WB, NS, WB, WS}, /* 72 */
+    {NB, WS, NB, WS, NB, NS, WB, NS, WB, NS}, /* 73 */
+    {NB, NS, NB, NS, NB, WS, WB, NS, WB, WS}, /* 74 */
+    {NB, WS, NB, NS, NB, WS, WB, NS, WB, NS}, /* 75 */
+    {NB, NS, NB, WS, NB, WS, WB, NS, WB, NS}, /* 76 */
+    {NB, NS, NB, NS, NB, NS, WB, WS, WB, WS}, /* 77 */
+    {NB, WS, NB, NS, NB, NS, WB, WS, WB, NS}, /* 78 */
+    {NB, NS, NB, WS, NB, NS, WB, WS, WB, NS}, /* 79 */
+    {WB, NS, NB, NS, NB, WS, WB, WS, NB, NS}, /* 80 */
+    {WB, WS, NB, NS, NB, NS, WB, NS, NB, WS}, /* 81 */
+    {WB, NS, NB, WS, NB, NS, WB, NS, NB, WS}, /* 82 */
+    {WB, WS, NB, WS, NB, NS, WB, NS, NB, NS}, /* 83 */
+    {WB, NS, NB, NS, NB, WS, WB, NS, NB, WS}, /* 84 */
+    {WB, WS, NB, NS, NB, WS, WB, NS, NB, NS}, /* 85 */
+    {WB, NS, NB, WS, NB, WS, WB, NS, NB, NS}, /* 86 */
+    {WB, NS, NB, NS, NB, NS, WB, WS, NB, WS}, /* 87 */
+    {WB, WS, NB, NS, NB, NS, WB, WS, NB, NS}, /* 88 */
+    {WB, NS, NB, WS, NB, NS, WB, WS, NB, NS}, /* 89 */
+    {NB, NS, WB, NS, NB, WS, WB, WS, NB, NS}, /* 90 */
+    {NB, WS, WB, NS, NB, NS, WB, NS, NB, WS}, /* 91 */
+    {NB, NS, WB, WS, NB, NS, WB, NS, NB, WS}, /* 92 */
+    {NB, WS, WB, WS, NB, NS, WB, NS, NB, NS}, /* 93 */
+    {NB, NS, WB, NS, NB, WS, WB, NS, NB, WS}, /* 94 */
+    {NB, WS, WB, NS, NB, WS, WB, NS, NB, NS}, /* 95 */
+    {NB, NS, WB, WS, NB, WS, WB, NS, NB, NS}, /* 96 */
+    {NB, NS, WB, NS, NB, NS, WB, WS, NB, WS}, /* 97 */
+    {NB, WS, WB, NS, NB, NS, WB, WS, NB, NS}, /* 98 */
+    {NB, NS, WB, WS, NB, NS, WB, WS, NB, NS}  /* 99 */
+};
+
+#undef NB
+#undef NS
+#undef WB
+#undef WS
+
+static bool has_bearer_bars = false;
+
+static inline void append_start_pattern(void)
 {
-    int offset = 0;
-    offset += draw_pattern(ctx->c, ITF14_BINARY_BAR, x + offset, ctx->y, ctx->narrow_bar, ctx->height);
-    offset += ctx->narrow_space;
-    offset += draw_pattern(ctx->c, ITF14_BINARY_BAR, x + offset, ctx->y, ctx->narrow_bar, ctx->height);
-    offset += ctx->narrow_space;
-    return offset;
+    append_bar_run(&bar_runs, true, ITF14_NARROW_BAR_BASE, false);
+    append_bar_run(&bar_runs, false, ITF14_NARROW_SPACE_BASE, false);
+    append_bar_run(&bar_runs, true, ITF14_NARROW_BAR_BASE, false);
+    append_bar_run(&bar_runs, false, ITF14_NARROW_SPACE_BASE, false);
 }
 
-static inline int draw_stop_pattern(const Itf14Context *ctx, int x)
+static inline void append_stop_pattern(void)
 {
-    int offset = 0;
-    offset += draw_pattern(ctx->c, ITF14_BINARY_BAR, x + offset, ctx->y, ctx->wide_bar, ctx->height);
-    offset += ctx->narrow_space;
-    offset += draw_pattern(ctx->c, ITF14_BINARY_BAR, x + offset, ctx->y, ctx->narrow_bar, ctx->height);
-    return offset;
+    append_bar_run(&bar_runs, true, ITF14_WIDE_BAR_BASE, false);
+    append_bar_run(&bar_runs, false, ITF14_NARROW_SPACE_BASE, false);
+    append_bar_run(&bar_runs, true, ITF14_NARROW_BAR_BASE, false);
 }
 
-static inline int draw_interleaved_2_of_5(const Itf14Context *ctx, int x, size_t group_start_index,
-                                          size_t group_end_index)
+static inline void append_interleaved_2_of_5(size_t group_start_index, size_t group_end_index)
 {
-    int offset = 0;
-    const char *bars_pattern = NULL;
-    const char *spaces_pattern = NULL;
-    int d1 = -1;
-    int d2 = -1;
     for (size_t i = group_start_index; i < group_end_index; i += 2) {
-        d1 = char_to_digit(data_buffer[i]);
-        d2 = char_to_digit(data_buffer[i + 1]);
-        bars_pattern = WIDTHS[d1];
-        spaces_pattern = WIDTHS[d2];
-        for (size_t j = 0; j < ITF14_WIDTHS_PER_DIGIT; ++j) {
-            offset += draw_pattern(ctx->c, ITF14_BINARY_BAR, x + offset, ctx->y,
-                                   ITF14_RESOLVE_WIDTH(bars_pattern[j], ctx->wide_bar, ctx->narrow_bar), ctx->height);
-            offset += ITF14_RESOLVE_WIDTH(spaces_pattern[j], ctx->wide_space, ctx->narrow_space);
+        int pair = (char_to_digit(data_buffer[i]) * DIGITS_COUNT) + char_to_digit(data_buffer[i + 1]);
+        const uint8_t *runs = PAIR_RUNS[pair];
+        for (int j = 0; j < ITF14_RUNS_PER_PAIR; j += 2) {
+            append_bar_run(&bar_runs, true, runs[j], false);
+            append_bar_run(&bar_runs, false, runs[j + 1], false);
         }
     }
-    return offset;
 }
 
-void render(void)
+/**
+ * @brief ITF-14 widths are not multiples of one module, so its runs are in base pixels and scale with dpr.
+ */
+static inline void compose_bar_runs(void)
+{
+    reset_bar_runs(&bar_runs);
+    append_start_pattern();
+    append_interleaved_2_of_5(ITF14_START_INDEX, ITF14_CHECKSUM_INDEX);
+    append_stop_pattern();
+}
+
+typedef struct {
+    int bearer_bar;
+    int bars_x;
+    int bars_y;
+    int bar_height;
+    int pair_width;
+    int text_y;
+} Itf14Layout;
+
+static inline int get_bearer_bar_width(void)
+{
+    return has_bearer_bars ? ITF14_BEARER_BAR_BASE * dpr : 0;
+}
+
+/**
+ * @brief Every digit has two wide and three narrow elements, so all pairs are equally wide.
+ */
+static inline int get_pair_width(void)
+{
+    int bars = (2 * ITF14_WIDE_BAR_BASE) + (3 * ITF14_NARROW_BAR_BASE);
+    int spaces = (2 * ITF14_WIDE_SPACE_BASE) + (3 * ITF14_NARROW_SPACE_BASE);
+    return (bars + spaces) * dpr;
+}
+
+static inline int get_symbol_width(void)
 {
     int narrow_bar = ITF14_NARROW_BAR_BASE * dpr;
     int narrow_space = ITF14_NARROW_SPACE_BASE * dpr;
     int wide_bar = ITF14_WIDE_BAR_BASE * dpr;
-    int wide_space = ITF14_WIDE_SPACE_BASE * dpr;
-    int bar_height_px = BASE_BAR_HEIGHT_PX * dpr;
     int horizontal_quiet_zone = HORIZONTAL_QUIET_ZONE_MULTIPLIER * narrow_space;
-    int text_bounding_height = SYMBOL_TEXT_BOUNDING_HEIGHT * dpr;
-    int padding_top = SYMBOL_TEXT_PADDING_TOP_Y * dpr;
-    int vertical_quiet_zone = BASE_VERTICAL_QUIET_ZONE_PX * dpr;
-    int pair_width = (2 * wide_bar + 3 * narrow_bar) + (2 * wide_space + 3 * narrow_space);
+    int pair_width = get_pair_width();
     int content_body_width = 7 * pair_width;
     int start_code_total_width = (2 * narrow_bar) + (2 * narrow_space);
     int stop_code_total_width = wide_bar + narrow_space + narrow_bar;
     int content_width_px = start_code_total_width + content_body_width + stop_code_total_width;
-    int content_height = bar_height_px + padding_top + text_bounding_height;
-    canvas_width = (2 * horizontal_quiet_zone) + content_width_px;
-    canvas_height = vertical_quiet_zone + content_height + vertical_quiet_zone;
-    Canvas c = canvas_create(pixels, canvas_width, canvas_height);
+    return (2 * get_bearer_bar_width()) + (2 * horizontal_quiet_zone) + content_width_px;
+}
+
+static inline int get_symbol_height(void)
+{
+    int content_height = (BASE_BAR_HEIGHT_PX + SYMBOL_TEXT_PADDING_TOP_Y + SYMBOL_TEXT_BOUNDING_HEIGHT) * dpr;
+    return (2 * BASE_VERTICAL_QUIET_ZONE_PX * dpr) + (2 * get_bearer_bar_width()) + content_height;
+}
+
+static inline Itf14Layout get_layout(void)
+{
+    int bearer_bar = get_bearer_bar_width();
+    int bar_height = BASE_BAR_HEIGHT_PX * dpr;
+    int bars_y = (BASE_VERTICAL_QUIET_ZONE_PX * dpr) + bearer_bar;
+    return (Itf14Layout){.bearer_bar = bearer_bar,
+                         .bars_x = bearer_bar + (HORIZONTAL_QUIET_ZONE_MULTIPLIER * ITF14_NARROW_SPACE_BASE * dpr),
+                         .bars_y = bars_y,
+                         .bar_height = bar_height,
+                         .pair_width = get_pair_width(),
+                         .text_y = bars_y + bar_height + bearer_bar + (SYMBOL_TEXT_PADDING_TOP_Y * dpr)};
+}
+
+/**
+ * @brief Frames the bars and quiet zones with a bearer bar, as printed on corrugated cases so that a skewed scan
+ * cannot read a partial symbol. Off by default.
+ */
+WASM_EXPORT("set_bearer_bars")
+void set_bearer_bars(bool enabled)
+{
+    has_bearer_bars = enabled;
+}
+
+/**
+ * @brief Keeps the 13 data digits; render() appends the check digit.
+ */
+bool normalize_data(int len)
+{
+    return pad_digit_data(len, ITF14_CHECKSUM_INDEX);
+}
+
+/**
+ * @brief ITF-14 has no uniform module, so the measured module count is its number of bars and spaces.
+ */
+const BarcodeMeasurement *measure(const char *data, int len)
+{
+    load_measure_input(data, len);
+    measurement.modules = ITF14_ELEMENT_COUNT;
+    measurement.width = get_symbol_width();
+    measurement.height = get_symbol_height();
+    return &measurement;
+}
+
+void render(void)
+{
+    Itf14Layout layout = get_layout();
+    canvas_width = get_symbol_width();
+    canvas_height = get_symbol_height();
+    STATS_RENDER_BEGIN();
+    STATS_STAGE_BEGIN(STATS_STAGE_RASTER);
+    Canvas c = create_symbol_canvas();
     canvas_fill_rect(&c, 0, 0, canvas_width, canvas_height, C_WHITE);
+    STATS_STAGE_END(STATS_STAGE_RASTER);
+    STATS_STAGE_BEGIN(STATS_STAGE_ENCODE);
     int checksum = mod10_complement(data_buffer, ITF14_CHECKSUM_INDEX, ITF14_ODD_POS_WEIGHT, ITF14_EVEN_POS_WEIGHT,
                                     ITF14_CHECKSUM_MODULO);
     data_buffer[ITF14_CHECKSUM_INDEX] = digit_to_char(checksum);
-    int curr_x = horizontal_quiet_zone;
-    int curr_y = vertical_quiet_zone;
-    Itf14Context ctx = {.c = &c,
-                        .y = curr_y,
-                        .height = bar_height_px,
-                        .narrow_bar = narrow_bar,
-                        .narrow_space = narrow_space,
-                        .wide_bar = wide_bar,
-                        .wide_space = wide_space};
-    curr_x += draw_start_pattern(&ctx, curr_x);
-    curr_x += draw_interleaved_2_of_5(&ctx, curr_x, ITF14_START_INDEX, ITF14_CHECKSUM_INDEX);
-    curr_x += draw_stop_pattern(&ctx, curr_x);
-    int text_y = curr_y + bar_height_px + padding_top;
-    draw_centered_text(&c, data_buffer, 0, canvas_width, text_y);
+    compose_bar_runs();
+    STATS_STAGE_END(STATS_STAGE_ENCODE);
+    STATS_STAGE_BEGIN(STATS_STAGE_RASTER);
+    emit_bar_runs(&c, &bar_runs, layout.bars_x, layout.bars_y, dpr, layout.bar_height, layout.bar_height);
+    canvas_stroke_rect(&c, 0, layout.bars_y - layout.bearer_bar, canvas_width,
+                       layout.bar_height + (2 * layout.bearer_bar), layout.bearer_bar, C_BLACK);
+    STATS_STAGE_END(STATS_STAGE_RASTER);
+    STATS_STAGE_BEGIN(STATS_STAGE_TEXT);
+    draw_centered_text(&c, data_buffer, 0, canvas_width, layout.text_y);
+    STATS_STAGE_END(STATS_STAGE_TEXT);
+    STATS_RENDER_END();
+}
+
+/**
+ * @brief Redraws the digit pairs touched by changed (bit i for digit i) over a copy of the previous frame, then the
+ * human-readable line, which is centered as a whole.
+ */
+static void redraw_changed_pairs(Canvas *c, const Itf14Layout *layout, uint32_t changed)
+{
+    int start_width = 2 * (ITF14_NARROW_BAR_BASE + ITF14_NARROW_SPACE_BASE) * dpr;
+    for (int i = ITF14_START_INDEX; i < ITF14_CHECKSUM_INDEX; i += 2) {
+        if (0 == (changed & (3u << i)))
+            continue;
+        int x = layout->bars_x + start_width + ((i / 2) * layout->pair_width);
+        canvas_fill_rect(c, x, layout->bars_y, layout->pair_width, layout->bar_height, C_WHITE);
+        reset_bar_runs(&bar_runs);
+        append_interleaved_2_of_5((size_t)i, (size_t)i + 2);
+        emit_bar_runs(c, &bar_runs, x, layout->bars_y, dpr, layout->bar_height, layout->bar_height);
+    }
+    canvas_fill_rect(c, 0, layout->text_y, canvas_width, canvas_height - layout->text_y, C_WHITE);
+    draw_centered_text(c, data_buffer, 0, canvas_width, layout->text_y);
+}
+
+/**
+ * @brief Renders count consecutive serials, start, start + stride, ..., back to back into dest (capacity pixels).
+ * start holds the 13 digits before the check digit; anything else renders nothing. Each frame after the first
+ * starts as a copy of the previous one; only the changed digit pairs and the text are redrawn, and the checksum is
+ * updated from the changed digits alone. Returns the number of frames written.
+ */
+WASM_EXPORT("render_sequence")
+int render_sequence(const char *start, int count, int stride, uint32_t *dest, size_t capacity)
+{
+    if (NULL == dest || count <= 0 || stride < 0 || !load_digit_data(start, ITF14_CHECKSUM_INDEX))
+        return 0;
+    Itf14Layout layout = get_layout();
+    canvas_width = get_symbol_width();
+    canvas_height = get_symbol_height();
+    size_t frame_pixels = (size_t)canvas_width * (size_t)canvas_height;
+    count = (int)MATH_MIN((size_t)count, capacity / frame_pixels);
+    if (0 == count || !reserve_render_target(dest, frame_pixels * (size_t)count) || !render_into(dest, frame_pixels))
+        return 0;
+    DigitSequence seq;
+    begin_digit_sequence(&seq, ITF14_CHECKSUM_INDEX, ITF14_ODD_POS_WEIGHT, ITF14_EVEN_POS_WEIGHT);
+    for (int i = 1; i < count; ++i) {
+        uint32_t *frame = dest + ((size_t)i * frame_pixels);
+        uint32_t changed = advance_digit_sequence(&seq, stride);
+        char checksum = digit_to_char(get_sequence_checksum(&seq));
+        if (checksum != data_buffer[ITF14_CHECKSUM_INDEX])
+            changed |= 1u << ITF14_CHECKSUM_INDEX;
+        data_buffer[ITF14_CHECKSUM_INDEX] = checksum;
+        rt_copy(frame, frame - frame_pixels, frame_pixels * sizeof(uint32_t));
+        Canvas c = canvas_create(frame, canvas_width, canvas_height);
+        redraw_changed_pairs(&c, &layout, changed);
+    }
+    return count;
 }
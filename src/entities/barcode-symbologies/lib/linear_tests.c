@@ -0,0 +1,297 @@
+#include "testing_utils.h"
+
+#if defined(LINEAR_SYMBOLOGY_CODE_128)
+#include "code_128.c"
+#define SYMBOLOGY_SOURCE "code_128.c"
+#define SAMPLE_PAYLOAD "BATCH 42"
+#define RAW_PAYLOAD "0123456789012345678901234567890123456789012345678901234567890123456789"
+#define FORMATTED_PAYLOAD "0123456789012345678901234567890123456789012345678901234567890123"
+#define INVALID_PAYLOAD "caf\xC3\xA9"
+#elif defined(LINEAR_SYMBOLOGY_ITF_14)
+#include "itf_14.c"
+#define SYMBOLOGY_SOURCE "itf_14.c"
+#define SAMPLE_PAYLOAD "1234567890123"
+#define RAW_PAYLOAD "42"
+#define FORMATTED_PAYLOAD "4200000000000"
+#define INVALID_PAYLOAD "1x"
+#define SEQUENCE_START "0999999999990"
+#else
+#include "ean_13.c"
+#define SYMBOLOGY_SOURCE "ean_13.c"
+#define SAMPLE_PAYLOAD "590123412345"
+#define RAW_PAYLOAD "42"
+#define FORMATTED_PAYLOAD "420000000000"
+#define INVALID_PAYLOAD "1x"
+#define SEQUENCE_START "599999999990"
+#endif
+
+#define EXPECTED_CAPACITY (2048 * 1024)
+#define SEQUENCE_FRAMES 20
+#define SEQUENCE_CAPACITY (SEQUENCE_FRAMES * 256 * 1024)
+
+static uint32_t expected[EXPECTED_CAPACITY];
+
+static void render_payload(const char *payload)
+{
+    load_data_buffer(payload, (int)strlen(payload));
+    render_into(expected, EXPECTED_CAPACITY);
+}
+
+static int write_batch_record(uint8_t *dest, const char *payload)
+{
+    uint32_t len = (uint32_t)strlen(payload);
+    for (int i = 0; i < BATCH_RECORD_HEADER_SIZE; ++i)
+        dest[i] = (uint8_t)(len >> (8 * i));
+    memcpy(dest + BATCH_RECORD_HEADER_SIZE, payload, len);
+    return BATCH_RECORD_HEADER_SIZE + (int)len;
+}
+
+void render_batch_places_each_symbol_centered_in_its_cell(void)
+{
+    render_payload(SAMPLE_PAYLOAD);
+    int symbol_width = canvas_width;
+    int symbol_height = canvas_height;
+    SheetLayout layout = {.cell_width = symbol_width + 10, .cell_height = symbol_height + 6, .gutter = 4, .columns = 2};
+    int size = write_batch_record(batch_buffer, SAMPLE_PAYLOAD);
+    size += write_batch_record(batch_buffer + size, SAMPLE_PAYLOAD);
+    ASSERT_EQUALS(2, render_batch(batch_buffer, (size_t)size, 2, &layout));
+    ASSERT_EQUALS((2 * layout.cell_width) + layout.gutter, canvas_width);
+    ASSERT_EQUALS(layout.cell_height, canvas_height);
+    size_t row_bytes = (size_t)symbol_width * sizeof(uint32_t);
+    const uint32_t *second_cell = pixels + (3 * canvas_width) + layout.cell_width + layout.gutter + 5;
+    for (int y = 0; y < symbol_height; ++y)
+        ASSERT_TRUE(0 == memcmp(second_cell + (y * canvas_width), expected + (y * symbol_width), row_bytes));
+    ASSERT_EQUALS(C_WHITE, pixels[0]);
+}
+
+void render_batch_formats_payloads_like_the_editor(void)
+{
+    render_payload(FORMATTED_PAYLOAD);
+    size_t pixel_count = (size_t)canvas_width * (size_t)canvas_height;
+    SheetLayout layout = {.cell_width = canvas_width, .cell_height = canvas_height, .gutter = 0, .columns = 1};
+    int size = write_batch_record(batch_buffer, RAW_PAYLOAD);
+    ASSERT_EQUALS(1, render_batch(batch_buffer, (size_t)size, 1, &layout));
+    ASSERT_TRUE(0 == memcmp(pixels, expected, pixel_count * sizeof(uint32_t)));
+}
+
+void render_batch_leaves_rejected_payloads_blank(void)
+{
+    render_payload(SAMPLE_PAYLOAD);
+    SheetLayout layout = {.cell_width = canvas_width, .cell_height = canvas_height, .gutter = 0, .columns = 3};
+    int size = write_batch_record(batch_buffer, SAMPLE_PAYLOAD);
+    size += write_batch_record(batch_buffer + size, INVALID_PAYLOAD);
+    size += write_batch_record(batch_buffer + size, SAMPLE_PAYLOAD);
+    ASSERT_EQUALS(2, render_batch(batch_buffer, (size_t)size, 3, &layout));
+    for (int y = 0; y < layout.cell_height; ++y)
+        for (int x = layout.cell_width; x < 2 * layout.cell_width; ++x)
+            ASSERT_EQUALS(C_WHITE, pixels[(y * canvas_width) + x]);
+}
+
+void render_batch_stops_at_a_record_past_the_records_size(void)
+{
+    render_payload(SAMPLE_PAYLOAD);
+    SheetLayout layout = {.cell_width = canvas_width, .cell_height = canvas_height, .gutter = 0, .columns = 3};
+    int first_size = write_batch_record(batch_buffer, SAMPLE_PAYLOAD);
+    int size = first_size + write_batch_record(batch_buffer + first_size, SAMPLE_PAYLOAD);
+    ASSERT_EQUALS(1, render_batch(batch_buffer, (size_t)size - 1, 2, &layout));
+    ASSERT_EQUALS(1, render_batch(batch_buffer, (size_t)first_size + 2, 2, &layout));
+    rt_fill8(batch_buffer + first_size, 0xFF, BATCH_RECORD_HEADER_SIZE);
+    ASSERT_EQUALS(1, render_batch(batch_buffer, (size_t)size, 3, &layout));
+}
+
+void canvas_subview_clips_drawing_to_its_region(void)
+{
+    static uint32_t sheet_pixels[8 * 6];
+    Canvas sheet = canvas_create(sheet_pixels, 8, 6);
+    canvas_fill_rect(&sheet, 0, 0, 8, 6, C_WHITE);
+    Canvas view = canvas_subview(&sheet, 2, 1, 10, 3);
+    ASSERT_EQUALS(6, view.width);
+    ASSERT_EQUALS(3, view.height);
+    ASSERT_EQUALS(8, view.stride);
+    canvas_fill_rect(&view, -5, -5, 100, 100, C_BLACK);
+    for (int y = 0; y < 6; ++y)
+        for (int x = 0; x < 8; ++x)
+            ASSERT_EQUALS(x >= 2 && y >= 1 && y < 4 ? C_BLACK : C_WHITE, sheet_pixels[(y * 8) + x]);
+    ASSERT_NULL(canvas_subview(&sheet, 8, 0, 2, 2).pixels);
+}
+
+void bar_runs_merge_adjacent_modules_of_the_same_color(void)
+{
+    static BarRunList list;
+    reset_bar_runs(&list);
+    append_bar_bits(&list, 0x6, 4, false);
+    append_bar_bits(&list, 0x7, 4, true);
+    append_bar_run(&list, true, 2, false);
+    uint16_t expected_runs[] = {0, 1, 2, 2, BAR_RUN_GUARD | 3, 0, 2};
+    ASSERT_EQUALS((int)(sizeof(expected_runs) / sizeof(expected_runs[0])), list.count);
+    for (int i = 0; i < list.count; ++i)
+        ASSERT_EQUALS(expected_runs[i], list.runs[i]);
+}
+
+void digit_sequence_tracks_the_checksum_incrementally(void)
+{
+    load_data_buffer("599999999990", 12);
+    DigitSequence seq;
+    begin_digit_sequence(&seq, 12, 3, 1);
+    for (int i = 0; i < 40; ++i) {
+        uint32_t changed = advance_digit_sequence(&seq, 7);
+        ASSERT_TRUE(0 != changed);
+        ASSERT_EQUALS(mod10_complement(data_buffer, 12, 3, 1, 10), get_sequence_checksum(&seq));
+    }
+    ASSERT_TRUE(0 == strncmp(data_buffer, "600000000270", 12));
+}
+
+void runtime_fills_write_exactly_the_requested_range(void)
+{
+    uint32_t words[40];
+    for (int i = 0; i < 40; ++i)
+        words[i] = 0xDEADBEEF;
+    rt_fill32(words + 1, C_BLACK, 37);
+    rt_fill32(words + 1, C_WHITE, 0);
+    ASSERT_EQUALS(0xDEADBEEF, words[0]);
+    for (int i = 1; i <= 37; ++i)
+        ASSERT_EQUALS(C_BLACK, words[i]);
+    ASSERT_EQUALS(0xDEADBEEF, words[38]);
+    uint8_t bytes[2] = {7, 7};
+    rt_zero(bytes, 1);
+    ASSERT_EQUALS(0, bytes[0]);
+    ASSERT_EQUALS(7, bytes[1]);
+    rt_copy(words + 2, words + 1, 3 * sizeof(uint32_t));
+    ASSERT_EQUALS(C_BLACK, words[4]);
+}
+
+#if defined(LINEAR_SYMBOLOGY_CODE_128)
+static void assert_encoded_symbols(const char *payload, const int *expected_symbols, int count)
+{
+    load_data_buffer(payload, (int)strlen(payload));
+    encode_symbols();
+    ASSERT_EQUALS(count + 2, next_symbol_idx);
+    for (int i = 0; i < count; ++i)
+        ASSERT_EQUALS(expected_symbols[i], symbol_buffer[i]);
+}
+
+void code_128_keywords_prefer_the_longest_match(void)
+{
+    int soh[] = {CODE128_START_A, 65};
+    assert_encoded_symbols("^SOH", soh, 2);
+    int so_then_letter[] = {CODE128_START_A, 78, 33};
+    assert_encoded_symbols("^SOA", so_then_letter, 3);
+}
+
+void code_128_unknown_keywords_and_trailing_carets_encode_the_caret(void)
+{
+    int unknown[] = {CODE128_START_B, 62, 56, 56};
+    assert_encoded_symbols("^XX", unknown, 4);
+    int trailing[] = {CODE128_START_B, 33, 34, 62};
+    assert_encoded_symbols("AB^", trailing, 4);
+}
+
+void code_128_function_keywords_in_code_set_c(void)
+{
+    int fnc1[] = {CODE128_START_C, 12, 34, CODE128_FNC_1, 56, 78};
+    assert_encoded_symbols("1234^FNC15678", fnc1, 6);
+    int fnc4[] = {CODE128_START_C, 12, 34, CODE128_CODE_B, CODE128_FNC4_CODE_SET_B, 33};
+    assert_encoded_symbols("1234^FNC4A", fnc4, 6);
+}
+#endif
+
+#if defined(LINEAR_SYMBOLOGY_ITF_14)
+void bearer_bars_frame_the_bars_and_quiet_zones(void)
+{
+    static uint32_t framed[EXPECTED_CAPACITY];
+    dpr = 2;
+    render_payload(SAMPLE_PAYLOAD);
+    int width = canvas_width;
+    int height = canvas_height;
+    Itf14Layout plain = get_layout();
+    set_bearer_bars(true);
+    const BarcodeMeasurement *m = measure(SAMPLE_PAYLOAD, (int)strlen(SAMPLE_PAYLOAD));
+    int bearer = ITF14_BEARER_BAR_BASE * dpr;
+    ASSERT_EQUALS(width + (2 * bearer), m->width);
+    ASSERT_EQUALS(height + (2 * bearer), m->height);
+    load_data_buffer(SAMPLE_PAYLOAD, (int)strlen(SAMPLE_PAYLOAD));
+    ASSERT_TRUE(render_into(framed, EXPECTED_CAPACITY));
+    ASSERT_EQUALS(m->width, canvas_width);
+    ASSERT_EQUALS(m->height, canvas_height);
+    Itf14Layout layout = get_layout();
+    int frame_top = layout.bars_y - bearer;
+    int frame_bottom = layout.bars_y + layout.bar_height + bearer;
+    for (int y = 0; y < canvas_height; ++y) {
+        for (int x = 0; x < canvas_width; ++x) {
+            bool is_frame_row = y >= frame_top && y < frame_bottom;
+            bool is_bearer = is_frame_row && (y < layout.bars_y || y >= frame_bottom - bearer || x < bearer ||
+                                              x >= canvas_width - bearer);
+            if (is_bearer)
+                ASSERT_EQUALS(C_BLACK, framed[(y * canvas_width) + x]);
+            else if (y < frame_top)
+                ASSERT_EQUALS(C_WHITE, framed[(y * canvas_width) + x]);
+        }
+    }
+    for (int y = 0; y < plain.bar_height; ++y)
+        ASSERT_TRUE(0 == memcmp(framed + ((layout.bars_y + y) * canvas_width) + bearer,
+                                expected + ((plain.bars_y + y) * width), (size_t)width * sizeof(uint32_t)));
+    set_bearer_bars(false);
+    render_payload(SAMPLE_PAYLOAD);
+    ASSERT_EQUALS(width, canvas_width);
+    ASSERT_EQUALS(height, canvas_height);
+    dpr = 1;
+}
+#endif
+
+#ifdef SEQUENCE_START
+void render_sequence_frames_match_full_renders(void)
+{
+    static uint32_t frames[SEQUENCE_CAPACITY];
+    static const int strides[] = {1, 7, 100003};
+    int digits = (int)strlen(SEQUENCE_START);
+    long long start = strtoll(SEQUENCE_START, NULL, 10);
+    for (size_t s = 0; s < sizeof(strides) / sizeof(strides[0]); ++s) {
+        ASSERT_EQUALS(SEQUENCE_FRAMES,
+                      render_sequence(SEQUENCE_START, SEQUENCE_FRAMES, strides[s], frames, SEQUENCE_CAPACITY));
+        size_t frame_pixels = (size_t)canvas_width * (size_t)canvas_height;
+        for (int i = 0; i < SEQUENCE_FRAMES; ++i) {
+            char serial[16];
+            snprintf(serial, sizeof(serial), "%0*lld", digits, start + ((long long)i * strides[s]));
+            render_payload(serial);
+            ASSERT_TRUE(0 == memcmp(frames + ((size_t)i * frame_pixels), expected, frame_pixels * sizeof(uint32_t)));
+        }
+    }
+}
+
+void render_sequence_rejects_starts_that_are_not_all_digits(void)
+{
+    static uint32_t frames[SEQUENCE_CAPACITY];
+    char start[] = SEQUENCE_START;
+    start[3] = 'x';
+    ASSERT_EQUALS(0, render_sequence(start, 2, 1, frames, SEQUENCE_CAPACITY));
+    ASSERT_EQUALS(0, render_sequence("42", 2, 1, frames, SEQUENCE_CAPACITY));
+    ASSERT_EQUALS(0, render_sequence(NULL, 2, 1, frames, SEQUENCE_CAPACITY));
+}
+#endif
+
+int main(void)
+{
+    TestCase linear_tests[] = {TEST_FUNC(render_batch_places_each_symbol_centered_in_its_cell),
+                               TEST_FUNC(render_batch_formats_payloads_like_the_editor),
+                               TEST_FUNC(render_batch_leaves_rejected_payloads_blank),
+                               TEST_FUNC(render_batch_stops_at_a_record_past_the_records_size),
+                               TEST_FUNC(canvas_subview_clips_drawing_to_its_region),
+                               TEST_FUNC(bar_runs_merge_adjacent_modules_of_the_same_color),
+                               TEST_FUNC(digit_sequence_tracks_the_checksum_incrementally),
+                               TEST_FUNC(runtime_fills_write_exactly_the_requested_range),
+#if defined(LINEAR_SYMBOLOGY_CODE_128)
+                               TEST_FUNC(code_128_keywords_prefer_the_longest_match),
+                               TEST_FUNC(code_128_unknown_keywords_and_trailing_carets_encode_the_caret),
+                               TEST_FUNC(code_128_function_keywords_in_code_set_c),
+#endif
+#if defined(LINEAR_SYMBOLOGY_ITF_14)
+                               TEST_FUNC(bearer_bars_frame_the_bars_and_quiet_zones),
+#endif
+#ifdef SEQUENCE_START
+                               TEST_FUNC(render_sequence_frames_match_full_renders),
+                               TEST_FUNC(render_sequence_rejects_starts_that_are_not_all_digits),
+#endif
+    };
+    RUN_TEST_SUITE(SYMBOLOGY_SOURCE, linear_tests);
+    return 0;
+}
@@ -5,6 +5,10 @@
 
 #include "unicode_to_sjis.h"
 
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
 #define MAX_QR_CODEWORDS 4096
 #define MAX_QR_INPUT_LEN 32768
 #define MAX_QR_MODULES 177
@@ -49,6 +53,8 @@
 #define ALPHA_PAIR_MULTIPLIER 45
 #define ALPHA_PAIR_BITS 11
 #define ALPHA_SINGLE_BITS 6
+#define ALPHA_LETTER_BASE_VALUE 10
+#define ALPHA_NOT_ENCODABLE (-1)
 
 #define KANJI_BITS_PER_CHAR 13
 
@@ -80,6 +86,9 @@
 #define UTF8_4_BYTE_DATA_MASK 0x07
 
 #define UTF8_CONTINUATION_MASK 0x3F
+#define UTF8_CONTINUATION_TAG_MASK 0xC0
+#define UTF8_CONTINUATION_PREFIX 0x80
+#define UTF8_MAX_SEQUENCE_LEN 4
 
 #define VERSION_GROUP_2_START 10
 #define VERSION_GROUP_3_START 27
@@ -88,18 +97,21 @@
 #define THRESHOLD_SWITCH_NUM_V10_26 15
 #define THRESHOLD_SWITCH_NUM_V27_40 17
 
-#define MAX_BLOCKS 81
 #define MAX_EC_CODEWORDS_PER_BLOCK 68
 
+#ifdef __wasm_simd128__
+#define SIMD_LANES 16
+#define SIMD_PADDING SIMD_LANES
+#else
+#define SIMD_PADDING 0
+#endif
+
 #define DIRECTION_UP 1
 
 #define FINDER_PATTERN_AREA_SIZE 8
-#define FINDER_PATTERN_INNER_OFFSET 2
-#define FINDER_PATTERN_INNER_SIZE 3
 #define FINDER_PATTERN_SIZE 7
 
 #define ALIGNMENT_PATTERN_CENTER_OFFSET 2
-#define ALIGNMENT_PATTERN_SIZE 5
 #define MAX_ALIGNMENT_COORDS 7
 #define NO_ALIGNMENT_VERSION 1
 
@@ -128,10 +140,42 @@
 #define PENALTY_N2 3
 #define PENALTY_N3 40
 #define PENALTY_N4 10
+#define PENALTY_BAND_SIZE 16
+
+#define MASK_PATTERN_COUNT 8
+#define NO_MASK (-1)
+#define MASK_SAMPLE_STRIDE 4
+#define MASK_STRATEGY_EXACT 0
+#define MASK_STRATEGY_SAMPLED 1
+#define MASK_STRATEGY_FIXED 2
+#define MASK_STRATEGY_BUDGETED 3
+#define MICROSECONDS_PER_MS 1000.0
+
+#define PLANE_WORD_BITS 64
+#define PLANE_ROW_WORDS ((MAX_QR_MODULES + PLANE_WORD_BITS - 1) / PLANE_WORD_BITS)
 
 #define ECI_MODE_INDICATOR 7
+#define ECI_ISO_8859_1_DESIGNATOR 3
+#define ECI_ISO_8859_15_DESIGNATOR 17
+#define ECI_SHIFT_JIS_DESIGNATOR 20
 #define ECI_UTF8_DESIGNATOR 26
 #define ECI_DESIGNATOR_BITS 8
+#define NO_ECI (-1)
+
+#define BYTE_NOT_ENCODABLE (-1)
+#define LATIN1_MAX_CODE_POINT 0xFF
+#define LATIN9_SUBSTITUTIONS_LEN 8
+#define SINGLE_BYTE_CHARSETS_LEN 2
+
+#define SEGMENT_CHARSET_ANY 0
+#define SEGMENT_CHARSET_NATIVE 1
+#define SEGMENT_CHARSET_UTF8 2
+#define SEGMENT_CHARSET_COUNT 3
+
+#define CHARSET_TRACE_BITS 2
+#define CHARSET_TRACE_MASK 0x3
+#define CHARSET_TRACE_CONTINUATION 0xFF
+#define CHARSET_UNREACHABLE (INT32_MAX / 2)
 
 typedef enum { EC_L, EC_M, EC_Q, EC_H } ErrorCorrectionLevel;
 
@@ -167,20 +211,37 @@ typedef struct {
     int step_col;
 } QRZigZag;
 
-typedef struct {
-    const uint8_t *data;
-    uint8_t *ec;
-    int data_len;
-    int ec_len;
-} RSBlock;
-
+/**
+ * @brief A run of input in one mode. Byte segments also record which charset their non-ASCII bytes belong to, so the
+ * encoder can switch ECI between them. UTF-8 byte segments are read back from the input, so Shift JIS characters
+ * they absorb are encoded in their UTF-8 form.
+ */
 typedef struct {
     int mode;
     int start;
     int len;
+    int charset;
 } QRSegment;
 
+/**
+ * @brief One grid row packed a module per bit, column c at bit c % PLANE_WORD_BITS of word c / PLANE_WORD_BITS.
+ */
+typedef uint64_t PlaneRow[PLANE_ROW_WORDS];
+
 typedef bool (*MaskEvaluator)(int, int);
+typedef int (*PenaltyBandScorer)(int begin, int end, int grid_dim);
+
+typedef int (*ByteEncoder)(uint32_t code_point);
+
+typedef struct {
+    int eci_designator;
+    ByteEncoder encode;
+} ByteCharset;
+
+typedef struct {
+    uint32_t code_point;
+    uint8_t byte;
+} Latin9Substitution;
 
 static uint8_t codeword_buffer[MAX_QR_CODEWORDS];
 static int global_bit_offset = 0;
@@ -188,14 +249,33 @@ static uint8_t interleaved_codewords[MAX_QR_CODEWORDS];
 
 static const char *qr_data;
 static ErrorCorrectionLevel error_correction_level = EC_M;
+static int mask_strategy = MASK_STRATEGY_EXACT;
+static int mask_strategy_param = 0;
+static double encode_started_at = 0;
 
 static bool kanji_mode_enabled = true;
-static bool requires_utf8_eci = false;
+static int eci_designator = NO_ECI;
 static uint8_t processed_data[MAX_QR_INPUT_LEN];
+static bool is_utf8_byte[MAX_QR_INPUT_LEN];
+static int source_idx_at[MAX_QR_INPUT_LEN + 1];
+static uint8_t charset_trace[MAX_QR_INPUT_LEN];
 static int processed_data_len = 0;
+static uint16_t numeric_run_at[MAX_QR_INPUT_LEN + 1];
+static uint16_t alpha_run_at[MAX_QR_INPUT_LEN + 1];
+static uint16_t kanji_run_at[MAX_QR_INPUT_LEN + 2];
 
 static uint8_t eval_base_grid[MAX_QR_MODULES][MAX_QR_MODULES];
 static uint8_t eval_grid[MAX_QR_MODULES][MAX_QR_MODULES];
+static int eval_grid_mask = NO_MASK;
+
+static uint8_t placement_row[MAX_QR_MODULES * MAX_QR_MODULES];
+static uint8_t placement_col[MAX_QR_MODULES * MAX_QR_MODULES];
+static int placement_len = 0;
+static int placement_version = 0;
+
+static PlaneRow symbol_plane[MAX_QR_MODULES];
+static PlaneRow mask_planes[MASK_PATTERN_COUNT][MAX_QR_MODULES];
+static int mask_plane_version[MASK_PATTERN_COUNT];
 
 static int module_size = 0;
 
@@ -208,7 +288,22 @@ static const int FORMAT_INFO_ROW[FORMAT_INFO_BITS] = {8, 8, 8, 8, 8, 8, 8, 8, 7,
 static const int PAD_PATTERN[] = {0xEC, 0x11};
 static const uint8_t PENALTY_RULE_3_PATTERN[7] = {1, 0, 1, 1, 1, 0, 1};
 
-static const char SPECIAL_ALPHANUMERIC_CHARS[] = " $%*+-./:";
+/**
+ * @brief Alphanumeric mode value of every byte, or ALPHA_NOT_ENCODABLE. Values below ALPHA_LETTER_BASE_VALUE are
+ * the digits, which numeric mode encodes more densely.
+ */
+static const int8_t ALPHANUMERIC_VALUES[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, 36, -1, -1, -1, 37, 38, -1, -1, -1, -1, 39, 40, -1, 41, 42, 43,
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  44, -1, -1, -1, -1, -1, -1, 10, 11, 12, 13, 14, 15, 16,
+    17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
 
 static const int INITIAL_THRESHOLD_ALPHA_TO_BYTE[3] = {6, 7, 8};
 static const int INITIAL_THRESHOLD_NUM_TO_BYTE[3] = {4, 4, 5};
@@ -220,6 +315,8 @@ static const int THRESH_SWITCH_BYTE_TO_ALPHA[3] = {11, 15, 16};
 static const int THRESH_SWITCH_BYTE_TO_NUM_A[3] = {6, 7, 8};
 static const int THRESH_SWITCH_BYTE_TO_NUM_B[3] = {6, 8, 9};
 
+static const int VERSION_GROUP_FIRST_VERSION[3] = {1, VERSION_GROUP_2_START, VERSION_GROUP_3_START};
+
 static const VersionCapacity VERSION_CAPACITIES[VERSION_CAPACITY_LEN] = {
     {1,  EC_L, 19,   1,  26,  19,  0,  0,   0  },
     {1,  EC_M, 16,   1,  26,  16,  0,  0,   0  },
@@ -431,6 +528,11 @@ static bool gf_initialized = false;
 static uint8_t gf_ilog[512];
 static uint8_t gf_log[256];
 
+#ifdef __wasm_simd128__
+static uint8_t gf_mul_lo_nibble[256][SIMD_LANES];
+static uint8_t gf_mul_hi_nibble[256][SIMD_LANES];
+#endif
+
 /**
  * @brief Initializes log and inverse log tables for Galois Field GF(2^8).
  * Primitive polynomial g(x) = x^8 + x^4 + x^3 + x^2 + 1 (0x11D) and primitive
@@ -452,6 +554,14 @@ static inline void initialize_gf_tables(void)
     }
     for (size_t i = 255; i < 512; ++i)
         gf_ilog[i] = gf_ilog[i - 255];
+#ifdef __wasm_simd128__
+    for (int y = 1; y < 256; ++y) {
+        for (int nibble = 1; nibble < SIMD_LANES; ++nibble) {
+            gf_mul_lo_nibble[y][nibble] = gf_ilog[gf_log[y] + gf_log[nibble]];
+            gf_mul_hi_nibble[y][nibble] = gf_ilog[gf_log[y] + gf_log[nibble << 4]];
+        }
+    }
+#endif
     gf_initialized = true;
 }
 
@@ -464,7 +574,7 @@ static inline uint8_t gf_mul(uint8_t x, uint8_t y)
 
 static inline const uint8_t *compute_generator_poly(int ec_block_len)
 {
-    static uint8_t g[MAX_EC_CODEWORDS_PER_BLOCK + 1];
+    static uint8_t g[MAX_EC_CODEWORDS_PER_BLOCK + 1 + SIMD_PADDING];
     g[0] = 1;
     for (int i = 0; i < ec_block_len; ++i) {
         uint8_t root = gf_ilog[i];
@@ -475,10 +585,45 @@ static inline const uint8_t *compute_generator_poly(int ec_block_len)
     return g;
 }
 
+#ifdef __wasm_simd128__
+/**
+ * @brief Multiplies 16 field elements by a scalar using split nibble tables, so
+ * each product is two table swizzles instead of a log/antilog lookup.
+ */
+static inline v128_t gf_mul_x16(uint8_t x, v128_t y)
+{
+    v128_t lo_products = wasm_v128_load(gf_mul_lo_nibble[x]);
+    v128_t hi_products = wasm_v128_load(gf_mul_hi_nibble[x]);
+    v128_t y_lo = wasm_v128_and(y, wasm_i8x16_splat(0x0F));
+    v128_t y_hi = wasm_u8x16_shr(y, 4);
+    return wasm_v128_xor(wasm_i8x16_swizzle(lo_products, y_lo), wasm_i8x16_swizzle(hi_products, y_hi));
+}
+
+/**
+ * @brief Computes the ec_len error correction codewords of a data block and stores them ec_stride bytes apart, so
+ * they can land directly in their interleaved positions.
+ */
+static inline void encode_rs_block(const uint8_t *data, int data_len, int ec_len, const uint8_t *g, uint8_t *ec,
+                                   int ec_stride)
+{
+    STATS_COUNT(rs_blocks_encoded, 1);
+    uint8_t work[MAX_EC_CODEWORDS_PER_BLOCK + SIMD_PADDING + 1] = {0};
+    for (int i = 0; i < data_len; ++i) {
+        uint8_t feedback = data[i] ^ work[0];
+        for (int idx = 0; idx < ec_len; idx += SIMD_LANES) {
+            v128_t shifted = wasm_v128_load(&work[idx + 1]);
+            v128_t product = gf_mul_x16(feedback, wasm_v128_load(&g[idx + 1]));
+            wasm_v128_store(&work[idx], wasm_v128_xor(shifted, product));
+        }
+        work[ec_len] = 0;
+    }
+    for (int i = 0; i < ec_len; ++i)
+        ec[i * ec_stride] = work[i];
+}
+#else
 static inline void shift_ec_buffer(uint8_t *ec, int ec_len)
 {
-    for (int idx = 0; idx < ec_len - 1; ++idx)
-        ec[idx] = ec[idx + 1];
+    rt_copy(ec, ec + 1, (size_t)(ec_len - 1));
     ec[ec_len - 1] = 0;
 }
 
@@ -490,55 +635,48 @@ static inline void apply_rs_feedback(uint8_t *ec, int ec_len, const uint8_t *g,
         ec[idx] ^= gf_mul(feedback, g[idx + 1]);
 }
 
-static inline void encode_rs_block(const RSBlock *block, const uint8_t *g)
+static inline void encode_rs_block(const uint8_t *data, int data_len, int ec_len, const uint8_t *g, uint8_t *ec,
+                                   int ec_stride)
 {
-    for (int i = 0; i < block->ec_len; ++i)
-        block->ec[i] = 0;
-    for (int i = 0; i < block->data_len; ++i) {
-        uint8_t feedback = block->data[i] ^ block->ec[0];
-        shift_ec_buffer(block->ec, block->ec_len);
-        apply_rs_feedback(block->ec, block->ec_len, g, feedback);
+    STATS_COUNT(rs_blocks_encoded, 1);
+    uint8_t work[MAX_EC_CODEWORDS_PER_BLOCK] = {0};
+    for (int i = 0; i < data_len; ++i) {
+        uint8_t feedback = data[i] ^ work[0];
+        shift_ec_buffer(work, ec_len);
+        apply_rs_feedback(work, ec_len, g, feedback);
     }
+    for (int i = 0; i < ec_len; ++i)
+        ec[i * ec_stride] = work[i];
+}
+#endif
+
+/**
+ * @brief Scatters a data block to its interleaved positions: column col of every block sits at col * total_blocks
+ * + block_idx, except the extra last codeword of the longer group 2 blocks, which follows all the shared columns.
+ */
+static inline void scatter_data_block(const uint8_t *data, int data_len, int block_idx, const VersionCapacity *vc)
+{
+    int total_blocks = vc->num_blocks_g1 + vc->num_blocks_g2;
+    int shared_len = vc->k_g1;
+    int offset = block_idx;
+    for (int col = 0; col < shared_len; ++col, offset += total_blocks)
+        interleaved_codewords[offset] = data[col];
+    if (data_len > shared_len)
+        interleaved_codewords[(shared_len * total_blocks) + block_idx - vc->num_blocks_g1] = data[shared_len];
 }
 
 static inline void generate_interleaved_codewords(const uint8_t *data_codewords, const VersionCapacity *vc)
 {
     int total_blocks = vc->num_blocks_g1 + vc->num_blocks_g2;
-    RSBlock blocks[MAX_BLOCKS];
-    uint8_t ec_blocks_data[MAX_BLOCKS][MAX_EC_CODEWORDS_PER_BLOCK];
     int ec_len = vc->c_g1 - vc->k_g1;
-    int max_data_len = (vc->num_blocks_g2 > 0) ? vc->k_g2 : vc->k_g1;
-    int data_offset = 0;
-    int b = 0;
-    for (; b < vc->num_blocks_g1; ++b) {
-        blocks[b].data_len = vc->k_g1;
-        blocks[b].ec_len = ec_len;
-        blocks[b].data = &data_codewords[data_offset];
-        blocks[b].ec = ec_blocks_data[b];
-        encode_rs_block(&blocks[b], compute_generator_poly(ec_len));
-        data_offset += vc->k_g1;
-    }
-    for (; b < total_blocks; ++b) {
-        blocks[b].data_len = vc->k_g2;
-        blocks[b].ec_len = ec_len;
-        blocks[b].data = &data_codewords[data_offset];
-        blocks[b].ec = ec_blocks_data[b];
-        encode_rs_block(&blocks[b], compute_generator_poly(ec_len));
-        data_offset += vc->k_g2;
-    }
-    int len = 0;
-    int total_data_cells = max_data_len * total_blocks;
-    for (int i = 0; i < total_data_cells; ++i) {
-        int col = i / total_blocks;
-        int b_idx = i % total_blocks;
-        if (col < blocks[b_idx].data_len)
-            interleaved_codewords[len++] = blocks[b_idx].data[col];
-    }
-    int total_ec_cells = ec_len * total_blocks;
-    for (int i = 0; i < total_ec_cells; ++i) {
-        int col = i / total_blocks;
-        int b_idx = i % total_blocks;
-        interleaved_codewords[len++] = blocks[b_idx].ec[col];
+    int total_data_len = (vc->num_blocks_g1 * vc->k_g1) + (vc->num_blocks_g2 * vc->k_g2);
+    const uint8_t *g = compute_generator_poly(ec_len);
+    const uint8_t *data = data_codewords;
+    for (int b = 0; b < total_blocks; ++b) {
+        int data_len = (b < vc->num_blocks_g1) ? vc->k_g1 : vc->k_g2;
+        scatter_data_block(data, data_len, b, vc);
+        encode_rs_block(data, data_len, ec_len, g, &interleaved_codewords[total_data_len + b], total_blocks);
+        data += data_len;
     }
 }
 
@@ -554,21 +692,9 @@ static inline void append_bits(int value, int bit_count)
     }
 }
 
-static inline int get_special_alpha_value(char c)
-{
-    for (int i = 0; NULL_TERMINATOR != SPECIAL_ALPHANUMERIC_CHARS[i]; ++i)
-        if (SPECIAL_ALPHANUMERIC_CHARS[i] == c)
-            return 36 + i;
-    return -1;
-}
-
 static inline int char_to_alpha_value(char c)
 {
-    if (is_digit(c))
-        return char_to_digit(c);
-    if (is_uppercased_alpha(c))
-        return c - 'A' + 10;
-    return get_special_alpha_value(c);
+    return ALPHANUMERIC_VALUES[(uint8_t)c];
 }
 
 static inline bool is_numeric(uint8_t c)
@@ -578,7 +704,7 @@ static inline bool is_numeric(uint8_t c)
 
 static inline bool is_alpha_exclusive(uint8_t c)
 {
-    return !is_numeric(c) && -1 != char_to_alpha_value((char)c);
+    return ALPHANUMERIC_VALUES[c] >= ALPHA_LETTER_BASE_VALUE;
 }
 
 static inline bool is_valid_sjis_trailer(uint8_t b)
@@ -588,10 +714,12 @@ static inline bool is_valid_sjis_trailer(uint8_t b)
     return SJIS_TRAILER_INVALID != b;
 }
 
-static inline bool is_kanji_char(const uint8_t *data, int i, int len)
+static inline bool is_kanji_pair(const uint8_t *data, int i, int len)
 {
     if (!kanji_mode_enabled || i + 1 >= len)
         return false;
+    if (is_utf8_byte[i] || is_utf8_byte[i + 1])
+        return false;
     uint8_t lead_byte = data[i];
     uint8_t trail_byte = data[i + 1];
     if (!is_valid_sjis_trailer(trail_byte))
@@ -602,39 +730,46 @@ static inline bool is_kanji_char(const uint8_t *data, int i, int len)
     return is_block_1 || is_block_2;
 }
 
-static inline bool is_byte_exclusive(const uint8_t *data, int i, int len)
+/**
+ * @brief Builds, in one backward pass, the length of the numeric, alphanumeric-only and Kanji runs starting at
+ * every position, so segmentation decides each mode switch in constant time for every version group.
+ */
+static inline void classify_input(const uint8_t *data, int len)
+{
+    numeric_run_at[len] = 0;
+    alpha_run_at[len] = 0;
+    kanji_run_at[len] = 0;
+    kanji_run_at[len + 1] = 0;
+    for (int i = len - 1; i >= 0; --i) {
+        numeric_run_at[i] = is_numeric(data[i]) ? (uint16_t)(numeric_run_at[i + 1] + 1) : 0;
+        alpha_run_at[i] = is_alpha_exclusive(data[i]) ? (uint16_t)(alpha_run_at[i + 1] + 1) : 0;
+        kanji_run_at[i] = is_kanji_pair(data, i, len) ? (uint16_t)(kanji_run_at[i + 2] + 1) : 0;
+    }
+}
+
+static inline bool is_kanji_char(int i)
 {
-    if (is_numeric(data[i]))
-        return false;
-    if (is_alpha_exclusive(data[i]))
-        return false;
-    if (is_kanji_char(data, i, len))
-        return false;
-    return true;
+    return 0 != kanji_run_at[i];
 }
 
-static inline int count_consecutive_numeric(const uint8_t *str, int start, int len)
+static inline bool is_byte_exclusive(const uint8_t *data, int i)
 {
-    int count = 0;
-    while (start + count < len && is_numeric(str[start + count]))
-        ++count;
-    return count;
+    return ALPHA_NOT_ENCODABLE == ALPHANUMERIC_VALUES[data[i]] && !is_kanji_char(i);
 }
 
-static inline int count_consecutive_alpha_exclusive(const uint8_t *str, int start, int len)
+static inline int count_consecutive_numeric(int start)
 {
-    int count = 0;
-    while (start + count < len && is_alpha_exclusive(str[start + count]))
-        ++count;
-    return count;
+    return numeric_run_at[start];
 }
 
-static inline int count_consecutive_kanji(const uint8_t *str, int start, int len)
+static inline int count_consecutive_alpha_exclusive(int start)
 {
-    int count = 0;
-    while (is_kanji_char(str, start + (count * 2), len))
-        ++count;
-    return count;
+    return alpha_run_at[start];
+}
+
+static inline int count_consecutive_kanji(int start)
+{
+    return kanji_run_at[start];
 }
 
 static inline int get_numeric_cci_bits(int version)
@@ -777,27 +912,28 @@ static inline void add_segment(int mode, int start_idx)
     segments[num_segments].mode = mode;
     segments[num_segments].start = start_idx;
     segments[num_segments].len = 0;
+    segments[num_segments].charset = SEGMENT_CHARSET_ANY;
     ++num_segments;
 }
 
 static inline int get_initial_mode_for_alpha(const uint8_t *data, int len, int vg)
 {
-    int count = count_consecutive_alpha_exclusive(data, 0, len);
+    int count = count_consecutive_alpha_exclusive(0);
     if (count >= INITIAL_THRESHOLD_ALPHA_TO_BYTE[vg - 1])
         return ALPHANUMERIC_MODE_INDICATOR;
-    if (count < len && is_byte_exclusive(data, count, len))
+    if (count < len && is_byte_exclusive(data, count))
         return BYTE_MODE_INDICATOR;
-    if (count < len && is_kanji_char(data, count, len))
+    if (count < len && is_kanji_char(count))
         return ALPHANUMERIC_MODE_INDICATOR;
     return ALPHANUMERIC_MODE_INDICATOR;
 }
 
 static inline int get_initial_mode_for_numeric(const uint8_t *data, int len, int vg)
 {
-    int count = count_consecutive_numeric(data, 0, len);
+    int count = count_consecutive_numeric(0);
     if (count >= len)
         return NUMERIC_MODE_INDICATOR;
-    if (count < INITIAL_THRESHOLD_NUM_TO_BYTE[vg - 1] && is_byte_exclusive(data, count, len))
+    if (count < INITIAL_THRESHOLD_NUM_TO_BYTE[vg - 1] && is_byte_exclusive(data, count))
         return BYTE_MODE_INDICATOR;
     if (count < INITIAL_THRESHOLD_NUM[vg - 1] && is_alpha_exclusive(data[count]))
         return ALPHANUMERIC_MODE_INDICATOR;
@@ -811,7 +947,7 @@ static inline bool is_numeric_or_alpha_exclusive(uint8_t c)
 
 static inline int get_initial_mode_for_kanji(const uint8_t *data, int len, int vg)
 {
-    int kanji_count = count_consecutive_kanji(data, 0, len);
+    int kanji_count = count_consecutive_kanji(0);
     int next_idx = kanji_count * 2;
     if (next_idx == len)
         return KANJI_MODE_INDICATOR;
@@ -825,9 +961,9 @@ static inline int get_initial_mode_for_kanji(const uint8_t *data, int len, int v
 
 static inline int determine_initial_mode(const uint8_t *data, int len, int vg)
 {
-    if (is_kanji_char(data, 0, len))
+    if (is_kanji_char(0))
         return get_initial_mode_for_kanji(data, len, vg);
-    if (is_byte_exclusive(data, 0, len))
+    if (is_byte_exclusive(data, 0))
         return BYTE_MODE_INDICATOR;
     if (is_alpha_exclusive(data[0]))
         return get_initial_mode_for_alpha(data, len, vg);
@@ -836,17 +972,17 @@ static inline int determine_initial_mode(const uint8_t *data, int len, int vg)
     return BYTE_MODE_INDICATOR;
 }
 
-static inline int get_mode_for_alpha_char(const uint8_t *data, int i, int len, int idx)
+static inline int get_mode_for_alpha_char(int i, int idx)
 {
-    if (count_consecutive_alpha_exclusive(data, i, len) >= THRESH_SWITCH_BYTE_TO_ALPHA[idx])
+    if (count_consecutive_alpha_exclusive(i) >= THRESH_SWITCH_BYTE_TO_ALPHA[idx])
         return ALPHANUMERIC_MODE_INDICATOR;
     return BYTE_MODE_INDICATOR;
 }
 
 static inline int get_mode_for_numeric_char(const uint8_t *data, int i, int len, int idx)
 {
-    int num_count = count_consecutive_numeric(data, i, len);
-    bool followed_by_byte = (i + num_count < len) && is_byte_exclusive(data, i + num_count, len);
+    int num_count = count_consecutive_numeric(i);
+    bool followed_by_byte = (i + num_count < len) && is_byte_exclusive(data, i + num_count);
     const int *thresh_arr = followed_by_byte ? THRESH_SWITCH_BYTE_TO_NUM_B : THRESH_SWITCH_BYTE_TO_NUM_A;
     if (num_count >= thresh_arr[idx])
         return NUMERIC_MODE_INDICATOR;
@@ -856,59 +992,223 @@ static inline int get_mode_for_numeric_char(const uint8_t *data, int i, int len,
 static inline int get_next_mode_from_byte(const uint8_t *data, int i, int len, int vg)
 {
     int idx = vg - 1;
-    if (is_kanji_char(data, i, len)) {
-        if (count_consecutive_kanji(data, i, len) >= THRESH_SWITCH_BYTE_TO_KANJI[idx])
+    if (is_kanji_char(i)) {
+        if (count_consecutive_kanji(i) >= THRESH_SWITCH_BYTE_TO_KANJI[idx])
             return KANJI_MODE_INDICATOR;
         return BYTE_MODE_INDICATOR;
     }
     if (is_alpha_exclusive(data[i]))
-        return get_mode_for_alpha_char(data, i, len, idx);
+        return get_mode_for_alpha_char(i, idx);
     if (is_numeric(data[i]))
         return get_mode_for_numeric_char(data, i, len, idx);
     return BYTE_MODE_INDICATOR;
 }
 
-static inline int get_next_mode_from_alpha(const uint8_t *data, int i, int len, int vg)
+static inline int get_next_mode_from_alpha(const uint8_t *data, int i, int vg)
 {
-    if (is_kanji_char(data, i, len))
+    if (is_kanji_char(i))
         return KANJI_MODE_INDICATOR;
-    if (is_byte_exclusive(data, i, len))
+    if (is_byte_exclusive(data, i))
         return BYTE_MODE_INDICATOR;
     if (is_numeric(data[i])) {
         int thresh = (1 == vg)   ? THRESHOLD_SWITCH_NUM_V1_9
                      : (2 == vg) ? THRESHOLD_SWITCH_NUM_V10_26
                                  : THRESHOLD_SWITCH_NUM_V27_40;
-        if (count_consecutive_numeric(data, i, len) >= thresh)
+        if (count_consecutive_numeric(i) >= thresh)
             return NUMERIC_MODE_INDICATOR;
     }
     return ALPHANUMERIC_MODE_INDICATOR;
 }
 
-static inline int get_next_mode_from_num(const uint8_t *data, int i, int len)
+static inline int get_next_mode_from_num(const uint8_t *data, int i)
 {
-    if (is_kanji_char(data, i, len))
+    if (is_kanji_char(i))
         return KANJI_MODE_INDICATOR;
-    if (is_byte_exclusive(data, i, len))
+    if (is_byte_exclusive(data, i))
         return BYTE_MODE_INDICATOR;
     if (is_alpha_exclusive(data[i]))
         return ALPHANUMERIC_MODE_INDICATOR;
     return NUMERIC_MODE_INDICATOR;
 }
 
-static inline int get_next_mode_from_kanji(const uint8_t *data, int i, int len)
+static inline int get_next_mode_from_kanji(const uint8_t *data, int i)
 {
-    if (is_kanji_char(data, i, len))
+    if (is_kanji_char(i))
         return KANJI_MODE_INDICATOR;
-    if (is_byte_exclusive(data, i, len))
+    if (is_byte_exclusive(data, i))
         return BYTE_MODE_INDICATOR;
     if (is_alpha_exclusive(data[i]))
         return ALPHANUMERIC_MODE_INDICATOR;
     return NUMERIC_MODE_INDICATOR;
 }
 
+/**
+ * @brief The ECI a segment must be read under. UTF-8 byte segments need ECI 26; Shift JIS bytes need an explicit
+ * ECI 20 once an earlier segment has moved the reader off its default. Other segments keep whatever is active.
+ */
+static inline int get_segment_eci(const QRSegment *seg, int active_eci)
+{
+    if (SEGMENT_CHARSET_UTF8 == seg->charset)
+        return ECI_UTF8_DESIGNATOR;
+    if (SEGMENT_CHARSET_NATIVE == seg->charset && NO_ECI == eci_designator && NO_ECI != active_eci)
+        return ECI_SHIFT_JIS_DESIGNATOR;
+    return active_eci;
+}
+
+static inline int get_charset_eci(int charset, int active_eci)
+{
+    QRSegment probe = {.mode = BYTE_MODE_INDICATOR, .charset = charset};
+    return get_segment_eci(&probe, active_eci);
+}
+
+static inline int get_eci_switch_bits(int charset, int active_eci)
+{
+    return get_charset_eci(charset, active_eci) == active_eci ? 0 : MODE_INDICATOR_BITS + ECI_DESIGNATOR_BITS;
+}
+
+static inline bool is_native_continuation(int i)
+{
+    return i > 0 && !is_utf8_byte[i - 1] && !is_utf8_byte[i] && source_idx_at[i - 1] == source_idx_at[i];
+}
+
+static inline bool is_native_byte(const uint8_t *data, int i)
+{
+    return !is_utf8_byte[i] && (data[i] > UTF8_1_BYTE_MAX || is_native_continuation(i));
+}
+
+/**
+ * @brief Bytes of the Shift JIS character at i that lie before end. They all map back to one input position.
+ */
+static inline int get_native_char_len(int i, int end)
+{
+    int j = i + 1;
+    while (j < end && is_native_continuation(j))
+        ++j;
+    return j - i;
+}
+
+/**
+ * @brief UTF-8 length of the Shift JIS character spanning [i, i + len), or 0 when the span is only part of one.
+ */
+static inline int get_native_char_utf8_len(int i, int len)
+{
+    if (is_native_continuation(i) || source_idx_at[i + len] == source_idx_at[i])
+        return 0;
+    return source_idx_at[i + len] - source_idx_at[i];
+}
+
+/**
+ * @brief Extends the cheapest way of reaching each charset state by one unit encoded in `charset`. A unit that
+ * changes the charset of a tagged segment pays for a new byte segment header and for any ECI switch.
+ */
+static inline void relax_charset_state(int *next_bits, uint8_t *trace, const int *bits, int charset, int unit_bits,
+                                       int header_bits, int entry_eci)
+{
+    for (int from = SEGMENT_CHARSET_ANY; from < SEGMENT_CHARSET_COUNT; ++from) {
+        if (bits[from] >= CHARSET_UNREACHABLE)
+            continue;
+        int candidate = bits[from] + unit_bits;
+        if (SEGMENT_CHARSET_ANY == from)
+            candidate += get_eci_switch_bits(charset, entry_eci);
+        else if (from != charset)
+            candidate += header_bits + get_eci_switch_bits(charset, get_charset_eci(from, entry_eci));
+        if (candidate < next_bits[charset]) {
+            next_bits[charset] = candidate;
+            int shift = charset * CHARSET_TRACE_BITS;
+            *trace = (uint8_t)((*trace & ~(CHARSET_TRACE_MASK << shift)) | (from << shift));
+        }
+    }
+}
+
+/**
+ * @brief Fills charset_trace over [begin, end) with the charset each unit is encoded in, choosing per unit between
+ * Shift JIS and UTF-8 so that the byte, segment header and ECI switch bits together are minimal. ASCII fits either
+ * charset; partial Shift JIS characters at the edges stay native.
+ */
+static inline void choose_byte_charsets(const uint8_t *data, int begin, int end, int vg, int entry_eci)
+{
+    int header_bits = MODE_INDICATOR_BITS + get_byte_cci_bits(VERSION_GROUP_FIRST_VERSION[vg - 1]);
+    int bits[SEGMENT_CHARSET_COUNT] = {0, CHARSET_UNREACHABLE, CHARSET_UNREACHABLE};
+    for (int i = begin; i < end;) {
+        int unit_len = 1;
+        int next_bits[SEGMENT_CHARSET_COUNT] = {CHARSET_UNREACHABLE, CHARSET_UNREACHABLE, CHARSET_UNREACHABLE};
+        uint8_t trace = 0;
+        if (is_utf8_byte[i]) {
+            relax_charset_state(next_bits, &trace, bits, SEGMENT_CHARSET_UTF8, BITS_PER_BYTE, header_bits, entry_eci);
+        } else if (is_native_byte(data, i)) {
+            unit_len = get_native_char_len(i, end);
+            int utf8_len = get_native_char_utf8_len(i, unit_len);
+            relax_charset_state(next_bits, &trace, bits, SEGMENT_CHARSET_NATIVE, unit_len * BITS_PER_BYTE,
+                                header_bits, entry_eci);
+            if (0 != utf8_len)
+                relax_charset_state(next_bits, &trace, bits, SEGMENT_CHARSET_UTF8, utf8_len * BITS_PER_BYTE,
+                                    header_bits, entry_eci);
+        } else {
+            for (int state = SEGMENT_CHARSET_ANY; state < SEGMENT_CHARSET_COUNT; ++state) {
+                next_bits[state] = MATH_MIN(bits[state] + BITS_PER_BYTE, CHARSET_UNREACHABLE);
+                trace = (uint8_t)(trace | (state << (state * CHARSET_TRACE_BITS)));
+            }
+        }
+        charset_trace[i] = trace;
+        for (int k = 1; k < unit_len; ++k)
+            charset_trace[i + k] = CHARSET_TRACE_CONTINUATION;
+        for (int state = SEGMENT_CHARSET_ANY; state < SEGMENT_CHARSET_COUNT; ++state)
+            bits[state] = next_bits[state];
+        i += unit_len;
+    }
+    int state = SEGMENT_CHARSET_ANY;
+    for (int candidate = SEGMENT_CHARSET_NATIVE; candidate < SEGMENT_CHARSET_COUNT; ++candidate)
+        if (bits[candidate] < bits[state])
+            state = candidate;
+    for (int i = end - 1; i >= begin; --i) {
+        if (CHARSET_TRACE_CONTINUATION == charset_trace[i])
+            continue;
+        int from = (charset_trace[i] >> (state * CHARSET_TRACE_BITS)) & CHARSET_TRACE_MASK;
+        charset_trace[i] = (uint8_t)state;
+        state = from;
+    }
+}
+
+/**
+ * @brief Replaces the byte segment that closes the segment list with one segment per charset run, as chosen by
+ * choose_byte_charsets. Only mixed Shift JIS and UTF-8 input has charsets to choose between.
+ */
+static inline void split_byte_segment_by_charset(const uint8_t *data, int vg, int entry_eci)
+{
+    QRSegment *seg = &segments[num_segments - 1];
+    if (!kanji_mode_enabled || BYTE_MODE_INDICATOR != seg->mode)
+        return;
+    int begin = seg->start;
+    int end = seg->start + seg->len;
+    choose_byte_charsets(data, begin, end, vg, entry_eci);
+    seg->len = 0;
+    for (int i = begin; i < end; ++i) {
+        int charset = charset_trace[i];
+        if (CHARSET_TRACE_CONTINUATION != charset && SEGMENT_CHARSET_ANY != charset) {
+            int current_charset = segments[num_segments - 1].charset;
+            if (SEGMENT_CHARSET_ANY != current_charset && charset != current_charset)
+                add_segment(BYTE_MODE_INDICATOR, i);
+            segments[num_segments - 1].charset = charset;
+        }
+        ++segments[num_segments - 1].len;
+    }
+}
+
+/**
+ * @brief Folds the ECI switches of segments [first, num_segments) into the active ECI.
+ */
+static inline int advance_active_eci(int first, int active_eci)
+{
+    for (int i = first; i < num_segments; ++i)
+        active_eci = get_segment_eci(&segments[i], active_eci);
+    return active_eci;
+}
+
 static inline void segment_data(const uint8_t *data, int len, int vg)
 {
+    STATS_COUNT(segment_passes, 1);
     num_segments = 0;
+    int active_eci = eci_designator;
     int current_mode = determine_initial_mode(data, len, vg);
     add_segment(current_mode, 0);
     for (int i = 0; i < len;) {
@@ -916,12 +1216,15 @@ static inline void segment_data(const uint8_t *data, int len, int vg)
         if (BYTE_MODE_INDICATOR == current_mode)
             next_mode = get_next_mode_from_byte(data, i, len, vg);
         else if (ALPHANUMERIC_MODE_INDICATOR == current_mode)
-            next_mode = get_next_mode_from_alpha(data, i, len, vg);
+            next_mode = get_next_mode_from_alpha(data, i, vg);
         else if (NUMERIC_MODE_INDICATOR == current_mode)
-            next_mode = get_next_mode_from_num(data, i, len);
+            next_mode = get_next_mode_from_num(data, i);
         else if (KANJI_MODE_INDICATOR == current_mode)
-            next_mode = get_next_mode_from_kanji(data, i, len);
+            next_mode = get_next_mode_from_kanji(data, i);
         if (next_mode != current_mode) {
+            int closed_segment = num_segments - 1;
+            split_byte_segment_by_charset(data, vg, active_eci);
+            active_eci = advance_active_eci(closed_segment, active_eci);
             current_mode = next_mode;
             add_segment(current_mode, i);
         }
@@ -929,14 +1232,38 @@ static inline void segment_data(const uint8_t *data, int len, int vg)
         ++segments[num_segments - 1].len;
         i += step;
     }
+    split_byte_segment_by_charset(data, vg, active_eci);
+}
+
+/**
+ * @brief Characters a segment's count field holds; for byte segments, the bytes actually encoded.
+ */
+static inline int get_segment_char_count(const QRSegment *seg)
+{
+    if (BYTE_MODE_INDICATOR != seg->mode || SEGMENT_CHARSET_UTF8 != seg->charset)
+        return seg->len;
+    return source_idx_at[seg->start + seg->len] - source_idx_at[seg->start];
+}
+
+static inline const uint8_t *get_byte_segment_data(const QRSegment *seg)
+{
+    if (SEGMENT_CHARSET_UTF8 != seg->charset)
+        return processed_data + seg->start;
+    return (const uint8_t *)qr_data + source_idx_at[seg->start];
 }
 
 static inline int calculate_total_bits(int version)
 {
     int total = 0;
-    if (requires_utf8_eci)
+    int active_eci = eci_designator;
+    if (NO_ECI != eci_designator)
         total += MODE_INDICATOR_BITS + ECI_DESIGNATOR_BITS;
     for (int i = 0; i < num_segments; ++i) {
+        int segment_eci = get_segment_eci(&segments[i], active_eci);
+        if (segment_eci != active_eci) {
+            total += MODE_INDICATOR_BITS + ECI_DESIGNATOR_BITS;
+            active_eci = segment_eci;
+        }
         total += MODE_INDICATOR_BITS;
         total += get_cci_bits(segments[i].mode, version);
         if (NUMERIC_MODE_INDICATOR == segments[i].mode)
@@ -946,19 +1273,45 @@ static inline int calculate_total_bits(int version)
         else if (KANJI_MODE_INDICATOR == segments[i].mode)
             total += segments[i].len * KANJI_BITS_PER_CHAR;
         else
-            total += segments[i].len * BITS_PER_BYTE;
+            total += get_segment_char_count(&segments[i]) * BITS_PER_BYTE;
     }
     return total;
 }
 
+/**
+ * @brief Collapses mixed Shift JIS and UTF-8 input into one UTF-8 byte segment when that is cheaper than the mode
+ * and ECI switches the segmenter settled on.
+ */
+static inline void merge_into_utf8_when_cheaper(int len, int version)
+{
+    bool has_utf8_segment = false;
+    for (int i = 0; i < num_segments; ++i)
+        has_utf8_segment = has_utf8_segment || SEGMENT_CHARSET_UTF8 == segments[i].charset;
+    if (!kanji_mode_enabled || !has_utf8_segment)
+        return;
+    QRSegment whole = {.mode = BYTE_MODE_INDICATOR, .start = 0, .len = len, .charset = SEGMENT_CHARSET_UTF8};
+    int utf8_bits = get_eci_switch_bits(SEGMENT_CHARSET_UTF8, eci_designator) + MODE_INDICATOR_BITS +
+                    get_byte_cci_bits(version) + (get_segment_char_count(&whole) * BITS_PER_BYTE);
+    if (utf8_bits >= calculate_total_bits(version))
+        return;
+    segments[0] = whole;
+    num_segments = 1;
+}
+
 static inline const VersionCapacity *determine_version_and_segment(const uint8_t *data, int len,
                                                                    ErrorCorrectionLevel target_ec_level)
 {
+    int segmented_group = 0;
+    classify_input(data, len);
     for (int i = 0; i < VERSION_CAPACITY_LEN; ++i) {
         if (VERSION_CAPACITIES[i].ec_level == target_ec_level) {
             int version = VERSION_CAPACITIES[i].version;
             int version_group = (version < VERSION_GROUP_2_START) ? 1 : ((version < VERSION_GROUP_3_START) ? 2 : 3);
-            segment_data(data, len, version_group);
+            if (version_group != segmented_group) {
+                segment_data(data, len, version_group);
+                merge_into_utf8_when_cheaper(len, version);
+                segmented_group = version_group;
+            }
             int total_bits = calculate_total_bits(version);
             int capacity_bits = VERSION_CAPACITIES[i].data_codewords * BITS_PER_BYTE;
             if (total_bits <= capacity_bits)
@@ -1279,17 +1632,80 @@ static inline void plot_eval_version_info(int version, int size)
     }
 }
 
+/**
+ * @brief Traces the zigzag once per version and keeps the data module coordinates in placement order, so every
+ * candidate mask and the final matrix can place their bits without re-checking reserved areas.
+ */
+static inline void cache_placement_order(int version, int grid_dim)
+{
+    if (version == placement_version)
+        return;
+    int row, col;
+    placement_len = 0;
+    QRZigZag zz = zigzag_create(grid_dim, version);
+    while (next_zigzag_coord(&zz, &row, &col)) {
+        placement_row[placement_len] = (uint8_t)row;
+        placement_col[placement_len] = (uint8_t)col;
+        ++placement_len;
+    }
+    placement_version = version;
+}
+
+static inline void set_plane_bit(PlaneRow *plane, int row, int col)
+{
+    plane[row][col / PLANE_WORD_BITS] |= (uint64_t)1 << (col % PLANE_WORD_BITS);
+}
+
+/**
+ * @brief Returns the bit-packed pattern of a mask over the data modules of the cached version, evaluating the mask
+ * rule on first use only. Function pattern modules are left clear, so the plane can be XORed onto a whole row.
+ */
+static inline PlaneRow *get_mask_plane(int mask)
+{
+    PlaneRow *plane = mask_planes[mask];
+    if (placement_version == mask_plane_version[mask])
+        return plane;
+    rt_zero(plane, sizeof(mask_planes[mask]));
+    for (int i = 0; i < placement_len; ++i)
+        if (evaluate_mask_condition(mask, placement_row[i], placement_col[i]))
+            set_plane_bit(plane, placement_row[i], placement_col[i]);
+    mask_plane_version[mask] = placement_version;
+    return plane;
+}
+
+/**
+ * @brief Packs the unmasked symbol: function patterns from eval_base_grid and the interleaved codewords along the
+ * placement order. Remainder bits stay light until a mask is applied.
+ */
+static inline void pack_symbol_plane(const QRContext *ctx)
+{
+    rt_zero(symbol_plane, (size_t)ctx->grid_dim * sizeof(PlaneRow));
+    for (int row = 0; row < ctx->grid_dim; ++row)
+        for (int col = 0; col < ctx->grid_dim; ++col)
+            if (1 == eval_base_grid[row][col])
+                set_plane_bit(symbol_plane, row, col);
+    int total_codewords = (ctx->vc->num_blocks_g1 * ctx->vc->c_g1) + (ctx->vc->num_blocks_g2 * ctx->vc->c_g2);
+    int total_bits = MATH_MIN(total_codewords * BITS_PER_BYTE, placement_len);
+    for (int placed_bits = 0; placed_bits < total_bits; ++placed_bits) {
+        int byte_idx = placed_bits / BITS_PER_BYTE;
+        int bit_idx = (BITS_PER_BYTE - 1) - (placed_bits % BITS_PER_BYTE);
+        if ((interleaved_codewords[byte_idx] >> bit_idx) & 1)
+            set_plane_bit(symbol_plane, placement_row[placed_bits], placement_col[placed_bits]);
+    }
+}
+
 static inline void build_base_grid(const QRContext *ctx)
 {
-    for (int r = 0; r < ctx->grid_dim; ++r)
-        for (int c = 0; c < ctx->grid_dim; ++c)
-            eval_base_grid[r][c] = 0;
+    eval_grid_mask = NO_MASK;
+    cache_placement_order(ctx->version, ctx->grid_dim);
+    rt_zero(eval_base_grid, (size_t)ctx->grid_dim * sizeof(eval_base_grid[0]));
     plot_eval_finder_pattern(0, 0, ctx->grid_dim);
     plot_eval_finder_pattern(0, ctx->grid_dim - FINDER_PATTERN_SIZE, ctx->grid_dim);
     plot_eval_finder_pattern(ctx->grid_dim - FINDER_PATTERN_SIZE, 0, ctx->grid_dim);
     plot_eval_timing_patterns(ctx->grid_dim);
     plot_eval_alignment_patterns(ctx->version, ctx->grid_dim);
     plot_eval_version_info(ctx->version, ctx->grid_dim);
+    pack_symbol_plane(ctx);
 }
 
 static inline int calculate_consecutive_penalty(int consecutive_count)
@@ -1297,10 +1713,10 @@ static inline int calculate_consecutive_penalty(int consecutive_count)
     return (consecutive_count >= 5) ? (PENALTY_N1 + (consecutive_count - 5)) : 0;
 }
 
-static inline int score_penalty_rule_1(int grid_dim)
+static inline int score_penalty_rule_1(int begin, int end, int grid_dim)
 {
     int penalty = 0;
-    for (int i = 0; i < grid_dim; ++i) {
+    for (int i = begin; i < end; ++i) {
         int consecutive_row_modules = 1;
         int consecutive_col_modules = 1;
         for (int j = 1; j < grid_dim; ++j) {
@@ -1330,13 +1746,34 @@ static inline bool is_solid_2x2_block(int row, int col)
     return (0 == block_sum || 4 == block_sum);
 }
 
-static inline int score_penalty_rule_2(int grid_size)
+static inline int count_solid_2x2_blocks(int row, int grid_size)
+{
+    int count = 0;
+    int col = 0;
+#ifdef __wasm_simd128__
+    v128_t empty = wasm_i8x16_splat(0);
+    v128_t full = wasm_i8x16_splat(4);
+    for (; col + SIMD_LANES < grid_size; col += SIMD_LANES) {
+        v128_t top = wasm_i8x16_add(wasm_v128_load(&eval_grid[row][col]), wasm_v128_load(&eval_grid[row][col + 1]));
+        v128_t bottom =
+            wasm_i8x16_add(wasm_v128_load(&eval_grid[row + 1][col]), wasm_v128_load(&eval_grid[row + 1][col + 1]));
+        v128_t block_sum = wasm_i8x16_add(top, bottom);
+        v128_t is_solid = wasm_v128_or(wasm_i8x16_eq(block_sum, empty), wasm_i8x16_eq(block_sum, full));
+        count += __builtin_popcount((uint32_t)wasm_i8x16_bitmask(is_solid));
+    }
+#endif
+    for (; col < grid_size - 1; ++col)
+        if (is_solid_2x2_block(row, col))
+            ++count;
+    return count;
+}
+
+static inline int score_penalty_rule_2(int begin, int end, int grid_size)
 {
     int penalty = 0;
-    for (int row = 0; row < grid_size - 1; ++row)
-        for (int col = 0; col < grid_size - 1; ++col)
-            if (is_solid_2x2_block(row, col))
-                penalty += PENALTY_N2;
+    int last_row = MATH_MIN(end, grid_size - 1);
+    for (int row = begin; row < last_row; ++row)
+        penalty += count_solid_2x2_blocks(row, grid_size) * PENALTY_N2;
     return penalty;
 }
 
@@ -1381,10 +1818,40 @@ static inline bool is_vertical_penalty_3(int row, int col, int grid_size)
     return (0 == before_sum) || (0 == after_sum);
 }
 
-static inline int score_penalty_rule_3(int grid_size)
+#ifdef __wasm_simd128__
+static inline int score_penalty_rule_3(int begin, int end, int grid_size)
+{
+    int penalty = 0;
+    for (int i = begin; i < end; ++i) {
+        int j = 0;
+        for (; j + SIMD_LANES + 6 <= grid_size; j += SIMD_LANES) {
+            v128_t matches = wasm_i8x16_splat(-1);
+            for (int k = 0; k < 7; ++k) {
+                v128_t expected = wasm_i8x16_splat((int8_t)PENALTY_RULE_3_PATTERN[k]);
+                matches = wasm_v128_and(matches, wasm_i8x16_eq(wasm_v128_load(&eval_grid[i][j + k]), expected));
+            }
+            uint32_t candidates = (uint32_t)wasm_i8x16_bitmask(matches);
+            while (0 != candidates) {
+                int lane = __builtin_ctz(candidates);
+                candidates &= candidates - 1;
+                if (is_horizontal_penalty_3(i, j + lane, grid_size))
+                    penalty += PENALTY_N3;
+            }
+        }
+        for (; j < grid_size - 6; ++j)
+            if (is_horizontal_penalty_3(i, j, grid_size))
+                penalty += PENALTY_N3;
+        for (j = 0; j < grid_size - 6; ++j)
+            if (is_vertical_penalty_3(j, i, grid_size))
+                penalty += PENALTY_N3;
+    }
+    return penalty;
+}
+#else
+static inline int score_penalty_rule_3(int begin, int end, int grid_size)
 {
     int penalty = 0;
-    for (int i = 0; i < grid_size; ++i) {
+    for (int i = begin; i < end; ++i) {
         for (int j = 0; j < grid_size - 6; ++j) {
             if (is_horizontal_penalty_3(i, j, grid_size))
                 penalty += PENALTY_N3;
@@ -1394,15 +1861,31 @@ static inline int score_penalty_rule_3(int grid_size)
     }
     return penalty;
 }
+#endif
+
+static inline int count_dark_modules(int row, int grid_size)
+{
+    int count = 0;
+    int col = 0;
+#ifdef __wasm_simd128__
+    v128_t dark = wasm_i8x16_splat(1);
+    for (; col + SIMD_LANES <= grid_size; col += SIMD_LANES) {
+        v128_t is_dark = wasm_i8x16_eq(wasm_v128_load(&eval_grid[row][col]), dark);
+        count += __builtin_popcount((uint32_t)wasm_i8x16_bitmask(is_dark));
+    }
+#endif
+    for (; col < grid_size; ++col)
+        if (1 == eval_grid[row][col])
+            ++count;
+    return count;
+}
 
 static inline int score_penalty_rule_4(int grid_size)
 {
     int total_dark_modules = 0;
     int total_modules = grid_size * grid_size;
     for (int row = 0; row < grid_size; ++row)
-        for (int col = 0; col < grid_size; ++col)
-            if (1 == eval_grid[row][col])
-                ++total_dark_modules;
+        total_dark_modules += count_dark_modules(row, grid_size);
     int dark_percentage = (total_dark_modules * 100) / total_modules;
     int lower_bound_percent = (dark_percentage / 5) * 5;
     int upper_bound_percent = lower_bound_percent + 5;
@@ -1433,50 +1916,55 @@ static inline void plot_eval_format_info(const QRContext *ctx)
     }
 }
 
-static inline void plot_eval_data_codewords(const QRContext *ctx)
+static inline void unpack_masked_row(int row, const PlaneRow mask_row, int grid_dim)
 {
-    int total_codewords = (ctx->vc->num_blocks_g1 * ctx->vc->c_g1) + (ctx->vc->num_blocks_g2 * ctx->vc->c_g2);
-    int total_bits = total_codewords * BITS_PER_BYTE;
-    int placed_bits = 0;
-    int row, col;
-    QRZigZag zz = zigzag_create(ctx->grid_dim, ctx->version);
-    while (next_zigzag_coord(&zz, &row, &col)) {
-        bool is_dark_module = false;
-        if (placed_bits < total_bits) {
-            int byte_idx = placed_bits / BITS_PER_BYTE;
-            int bit_idx = (BITS_PER_BYTE - 1) - (placed_bits % BITS_PER_BYTE);
-            is_dark_module = (interleaved_codewords[byte_idx] >> bit_idx) & 1;
-        }
-        if (evaluate_mask_condition(ctx->mask_pattern, row, col))
-            is_dark_module = !is_dark_module;
-        eval_grid[row][col] = is_dark_module ? 1 : 0;
-        ++placed_bits;
+    for (int word = 0; word < PLANE_ROW_WORDS; ++word) {
+        uint64_t bits = symbol_plane[row][word] ^ mask_row[word];
+        int first_col = word * PLANE_WORD_BITS;
+        int end_col = MATH_MIN(first_col + PLANE_WORD_BITS, grid_dim);
+        for (int col = first_col; col < end_col; ++col, bits >>= 1)
+            eval_grid[row][col] = (uint8_t)(bits & 1);
     }
 }
 
 static inline void populate_eval_grid(const QRContext *ctx)
 {
+    PlaneRow *mask_plane = get_mask_plane(ctx->mask_pattern);
     for (int row = 0; row < ctx->grid_dim; ++row)
-        for (int col = 0; col < ctx->grid_dim; ++col)
-            eval_grid[row][col] = eval_base_grid[row][col];
+        unpack_masked_row(row, mask_plane[row], ctx->grid_dim);
     plot_eval_format_info(ctx);
-    plot_eval_data_codewords(ctx);
+    eval_grid_mask = ctx->mask_pattern;
 }
 
-static inline int score_mask(QRContext *ctx)
+/**
+ * @brief Adds one penalty rule band by band, stopping once the total reaches the bound.
+ */
+static inline int accumulate_penalty(PenaltyBandScorer score_band, int penalty, int bound, int grid_dim)
+{
+    for (int begin = 0; begin < grid_dim && penalty < bound; begin += PENALTY_BAND_SIZE)
+        penalty += score_band(begin, MATH_MIN(begin + PENALTY_BAND_SIZE, grid_dim), grid_dim);
+    return penalty;
+}
+
+/**
+ * @brief Scores the current mask, cheapest rule first. Penalties never decrease, so scoring stops as soon as the
+ * total reaches the bound; the result is then only known to be at least the bound.
+ */
+static inline int score_mask(QRContext *ctx, int bound)
 {
+    STATS_COUNT(masks_scored, 1);
     populate_eval_grid(ctx);
-    return score_penalty_rule_1(ctx->grid_dim) + score_penalty_rule_2(ctx->grid_dim) +
-           score_penalty_rule_3(ctx->grid_dim) + score_penalty_rule_4(ctx->grid_dim);
+    int penalty = score_penalty_rule_4(ctx->grid_dim);
+    penalty = accumulate_penalty(score_penalty_rule_2, penalty, bound, ctx->grid_dim);
+    penalty = accumulate_penalty(score_penalty_rule_1, penalty, bound, ctx->grid_dim);
+    return accumulate_penalty(score_penalty_rule_3, penalty, bound, ctx->grid_dim);
 }
 
-static inline int find_optimal_mask(QRContext *ctx)
+static inline int find_optimal_mask_from(QRContext *ctx, int first_mask, int optimal_mask, int min_penalty)
 {
-    int optimal_mask = 0;
-    int min_penalty = INT32_MAX;
-    for (int mask_idx = 0; mask_idx < 8; ++mask_idx) {
+    for (int mask_idx = first_mask; mask_idx < MASK_PATTERN_COUNT; ++mask_idx) {
         ctx->mask_pattern = mask_idx;
-        int current_penalty = score_mask(ctx);
+        int current_penalty = score_mask(ctx, min_penalty);
         if (current_penalty < min_penalty) {
             min_penalty = current_penalty;
             optimal_mask = mask_idx;
@@ -1485,161 +1973,119 @@ static inline int find_optimal_mask(QRContext *ctx)
     return optimal_mask;
 }
 
-static inline void apply_mask_to_codewords(const QRContext *ctx, int mask)
-{
-    int total_codewords = (ctx->vc->num_blocks_g1 * ctx->vc->c_g1) + (ctx->vc->num_blocks_g2 * ctx->vc->c_g2);
-    int total_bits = total_codewords * BITS_PER_BYTE;
-    int placed_bits = 0;
-    int row, col;
-    QRZigZag zz = zigzag_create(ctx->grid_dim, ctx->version);
-    while (placed_bits < total_bits && next_zigzag_coord(&zz, &row, &col)) {
-        if (evaluate_mask_condition(mask, row, col)) {
-            int byte_idx = placed_bits / BITS_PER_BYTE;
-            int bit_idx = 7 - (placed_bits % BITS_PER_BYTE);
-            interleaved_codewords[byte_idx] ^= (1 << bit_idx);
-        }
-        ++placed_bits;
-    }
-}
-
-static inline int apply_best_mask(QRContext *ctx)
-{
-    build_base_grid(ctx);
-    int mask = find_optimal_mask(ctx);
-    apply_mask_to_codewords(ctx, mask);
-    return mask;
-}
-
-static inline void emplace_finder_pattern(Canvas *c, int x, int y)
-{
-    canvas_stroke_rect(c, x, y, FINDER_PATTERN_SIZE * module_size, FINDER_PATTERN_SIZE * module_size, module_size,
-                       C_BLACK);
-    canvas_fill_rect(c, x + (FINDER_PATTERN_INNER_OFFSET * module_size),
-                     y + (FINDER_PATTERN_INNER_OFFSET * module_size), FINDER_PATTERN_INNER_SIZE * module_size,
-                     FINDER_PATTERN_INNER_SIZE * module_size, C_BLACK);
-}
-
-static inline void emplace_finder_patterns(const QRContext *ctx)
+static inline int find_optimal_mask(QRContext *ctx)
 {
-    int top_left_x = ctx->quiet_zone_width;
-    int top_left_y = ctx->quiet_zone_width;
-    emplace_finder_pattern(ctx->canvas, top_left_x, top_left_y);
-    int top_right_x = ctx->quiet_zone_width + ((ctx->grid_dim - FINDER_PATTERN_SIZE) * module_size);
-    int top_right_y = ctx->quiet_zone_width;
-    emplace_finder_pattern(ctx->canvas, top_right_x, top_right_y);
-    int bottom_left_x = ctx->quiet_zone_width;
-    int bottom_left_y = ctx->quiet_zone_width + ((ctx->grid_dim - FINDER_PATTERN_SIZE) * module_size);
-    emplace_finder_pattern(ctx->canvas, bottom_left_x, bottom_left_y);
+    return find_optimal_mask_from(ctx, 0, 0, INT32_MAX);
 }
 
-static inline void emplace_timing_patterns(const QRContext *ctx)
+/**
+ * @brief Estimates a mask's penalty from every MASK_SAMPLE_STRIDE-th row and column, scaled back up to the full
+ * grid. Rule 4 is a whole-grid ratio and cheap, so it stays exact.
+ */
+static inline int score_mask_sampled(QRContext *ctx)
 {
-    for (int i = FINDER_PATTERN_AREA_SIZE; i <= ctx->grid_dim - TIMING_PATTERN_END_MARGIN; ++i) {
-        uint32_t color = (i % 2 == 0) ? C_BLACK : C_WHITE;
-        canvas_fill_rect(ctx->canvas, ctx->quiet_zone_width + (i * module_size),
-                         ctx->quiet_zone_width + (TIMING_PATTERN_COORD * module_size), module_size, module_size, color);
-        canvas_fill_rect(ctx->canvas, ctx->quiet_zone_width + (TIMING_PATTERN_COORD * module_size),
-                         ctx->quiet_zone_width + (i * module_size), module_size, module_size, color);
+    STATS_COUNT(masks_scored, 1);
+    populate_eval_grid(ctx);
+    int sampled_penalty = 0;
+    for (int i = 0; i < ctx->grid_dim; i += MASK_SAMPLE_STRIDE) {
+        sampled_penalty += score_penalty_rule_2(i, i + 1, ctx->grid_dim);
+        sampled_penalty += score_penalty_rule_1(i, i + 1, ctx->grid_dim);
+        sampled_penalty += score_penalty_rule_3(i, i + 1, ctx->grid_dim);
     }
+    return score_penalty_rule_4(ctx->grid_dim) + (sampled_penalty * MASK_SAMPLE_STRIDE);
 }
 
-static inline void emplace_alignment_pattern(Canvas *c, int cx, int cy, int quiet_zone_width)
-{
-    int box_x = quiet_zone_width + ((cx - ALIGNMENT_PATTERN_CENTER_OFFSET) * module_size);
-    int box_y = quiet_zone_width + ((cy - ALIGNMENT_PATTERN_CENTER_OFFSET) * module_size);
-    canvas_stroke_rect(c, box_x, box_y, ALIGNMENT_PATTERN_SIZE * module_size, ALIGNMENT_PATTERN_SIZE * module_size,
-                       module_size, C_BLACK);
-    canvas_fill_rect(c, box_x + (ALIGNMENT_PATTERN_CENTER_OFFSET * module_size),
-                     box_y + (ALIGNMENT_PATTERN_CENTER_OFFSET * module_size), module_size, module_size, C_BLACK);
-}
-
-static inline void emplace_alignment_patterns(const QRContext *ctx)
+/**
+ * @brief Ranks all masks by their sampled penalty, then scores only the two best exactly.
+ */
+static inline int find_sampled_mask(QRContext *ctx)
 {
-    if (NO_ALIGNMENT_VERSION == ctx->version)
-        return;
-    const int *coords = ALIGNMENT_PATTERN_COORDS[ctx->version];
-    int num_coords = get_alignment_coords_count(coords);
-    for (int i = 0; i < num_coords; ++i) {
-        for (int j = 0; j < num_coords; ++j) {
-            int row = coords[i];
-            int col = coords[j];
-            if (is_overlapping_finder_pattern(row, col, ctx->grid_dim))
-                continue;
-            emplace_alignment_pattern(ctx->canvas, col, row, ctx->quiet_zone_width);
+    int best_mask = 0;
+    int best_estimate = INT32_MAX;
+    int runner_up_mask = 0;
+    int runner_up_estimate = INT32_MAX;
+    for (int mask_idx = 0; mask_idx < MASK_PATTERN_COUNT; ++mask_idx) {
+        ctx->mask_pattern = mask_idx;
+        int estimate = score_mask_sampled(ctx);
+        if (estimate < best_estimate) {
+            runner_up_mask = best_mask;
+            runner_up_estimate = best_estimate;
+            best_mask = mask_idx;
+            best_estimate = estimate;
+        } else if (estimate < runner_up_estimate) {
+            runner_up_mask = mask_idx;
+            runner_up_estimate = estimate;
         }
     }
+    int first_mask = MATH_MIN(best_mask, runner_up_mask);
+    int second_mask = MATH_MAX(best_mask, runner_up_mask);
+    ctx->mask_pattern = first_mask;
+    int first_penalty = score_mask(ctx, INT32_MAX);
+    ctx->mask_pattern = second_mask;
+    return score_mask(ctx, first_penalty) < first_penalty ? second_mask : first_mask;
 }
 
-static inline void emplace_format_info(const QRContext *ctx)
+/**
+ * @brief Scores the first mask exactly and times it. If scoring the other seven the same way would take the render
+ * past its budget, the selection falls back to sampled scoring; otherwise it finishes exactly.
+ */
+static inline int find_budgeted_mask(QRContext *ctx)
 {
-    int format_bits = get_format_info(ctx->ec_level, ctx->mask_pattern);
-    int dark_x = ctx->quiet_zone_width + (FORMAT_INFO_COORD * module_size);
-    int dark_y = ctx->quiet_zone_width + ((ctx->grid_dim - FORMAT_INFO_COORD) * module_size);
-    canvas_fill_rect(ctx->canvas, dark_x, dark_y, module_size, module_size, C_BLACK);
-    for (int i = 0; i < FORMAT_INFO_BITS; ++i) {
-        uint8_t bit = (uint8_t)((format_bits >> i) & 1);
-        uint32_t color = bit ? C_BLACK : C_WHITE;
-        int x1 = FORMAT_INFO_COL[i];
-        int y1 = FORMAT_INFO_ROW[i];
-        int x2, y2;
-        if (i < 8) {
-            x2 = ctx->grid_dim - 1 - i;
-            y2 = FORMAT_INFO_COORD;
-        } else {
-            x2 = FORMAT_INFO_COORD;
-            y2 = ctx->grid_dim - FORMAT_INFO_BITS + i;
-        }
-        int top_left_x = ctx->quiet_zone_width + (x1 * module_size);
-        int top_left_y = ctx->quiet_zone_width + (y1 * module_size);
-        canvas_fill_rect(ctx->canvas, top_left_x, top_left_y, module_size, module_size, color);
-        int split_x = ctx->quiet_zone_width + (x2 * module_size);
-        int split_y = ctx->quiet_zone_width + (y2 * module_size);
-        canvas_fill_rect(ctx->canvas, split_x, split_y, module_size, module_size, color);
-    }
+    double budget_ms = mask_strategy_param / MICROSECONDS_PER_MS;
+    double mask_started_at = now();
+    ctx->mask_pattern = 0;
+    int first_penalty = score_mask(ctx, INT32_MAX);
+    double mask_ms = now() - mask_started_at;
+    double projected_ms = (now() - encode_started_at) + (mask_ms * (MASK_PATTERN_COUNT - 1));
+    if (projected_ms > budget_ms)
+        return find_sampled_mask(ctx);
+    return find_optimal_mask_from(ctx, 1, 0, first_penalty);
 }
 
-static inline void emplace_version_info(const QRContext *ctx)
+static inline int select_mask(QRContext *ctx)
 {
-    if (ctx->version < VERSION_INFO_MIN_VERSION)
-        return;
-    int version_bits = get_version_info(ctx->version);
-    for (int i = 0; i < VERSION_INFO_BITS; ++i) {
-        uint8_t bit = (uint8_t)((version_bits >> i) & 1);
-        uint32_t color = bit ? C_BLACK : C_WHITE;
-        int vi_row = i / 3;
-        int vi_col = i % 3;
-        int top_right_x = ctx->grid_dim - VERSION_INFO_EDGE_OFFSET + vi_col;
-        int top_right_y = vi_row;
-        canvas_fill_rect(ctx->canvas, ctx->quiet_zone_width + (top_right_x * module_size),
-                         ctx->quiet_zone_width + (top_right_y * module_size), module_size, module_size, color);
-        int bottom_left_x = vi_row;
-        int bottom_left_y = ctx->grid_dim - VERSION_INFO_EDGE_OFFSET + vi_col;
-        canvas_fill_rect(ctx->canvas, ctx->quiet_zone_width + (bottom_left_x * module_size),
-                         ctx->quiet_zone_width + (bottom_left_y * module_size), module_size, module_size, color);
-    }
+    if (MASK_STRATEGY_FIXED == mask_strategy)
+        return mask_strategy_param;
+    if (MASK_STRATEGY_SAMPLED == mask_strategy)
+        return find_sampled_mask(ctx);
+    if (MASK_STRATEGY_BUDGETED == mask_strategy)
+        return find_budgeted_mask(ctx);
+    return find_optimal_mask(ctx);
 }
 
-static inline void emplace_codewords(const QRContext *ctx)
+/**
+ * @brief Leaves the finished symbol in eval_grid: function patterns, format and version info, and the data under the
+ * chosen mask. Scoring has usually just built that grid already, in which case it is kept as is.
+ */
+static inline int build_module_matrix(QRContext *ctx)
 {
-    int total_codewords = (ctx->vc->num_blocks_g1 * ctx->vc->c_g1) + (ctx->vc->num_blocks_g2 * ctx->vc->c_g2);
-    int total_bits = total_codewords * BITS_PER_BYTE;
-    int placed_bits = 0;
-    int row, col;
-    QRZigZag zz = zigzag_create(ctx->grid_dim, ctx->version);
-    while (next_zigzag_coord(&zz, &row, &col)) {
-        bool is_dark_module;
-        bool is_padding_remainder = placed_bits >= total_bits;
-        if (is_padding_remainder)
-            is_dark_module = evaluate_mask_condition(ctx->mask_pattern, row, col);
-        else {
-            int byte_index = placed_bits / BITS_PER_BYTE;
-            int bit_within_byte = (BITS_PER_BYTE - 1) - (placed_bits % BITS_PER_BYTE);
-            is_dark_module = (interleaved_codewords[byte_index] >> bit_within_byte) & 1;
+    build_base_grid(ctx);
+    int mask = select_mask(ctx);
+    ctx->mask_pattern = mask;
+    if (mask != eval_grid_mask)
+        populate_eval_grid(ctx);
+    return mask;
+}
+
+/**
+ * @brief Paints the dark modules of the finished matrix over the white background, one rect per horizontal run.
+ */
+static inline void emplace_modules(const QRContext *ctx)
+{
+    for (int row = 0; row < ctx->grid_dim; ++row) {
+        int y = ctx->quiet_zone_width + (row * module_size);
+        int col = 0;
+        while (col < ctx->grid_dim) {
+            if (0 == eval_grid[row][col]) {
+                ++col;
+                continue;
+            }
+            int run_start = col;
+            while (col < ctx->grid_dim && 0 != eval_grid[row][col])
+                ++col;
+            canvas_fill_rect(ctx->canvas, ctx->quiet_zone_width + (run_start * module_size), y,
+                             (col - run_start) * module_size, module_size, C_BLACK);
         }
-        uint32_t module_color = is_dark_module ? C_BLACK : C_WHITE;
-        canvas_fill_rect(ctx->canvas, ctx->quiet_zone_width + (col * module_size),
-                         ctx->quiet_zone_width + (row * module_size), module_size, module_size, module_color);
-        ++placed_bits;
     }
 }
 
@@ -1722,66 +2168,220 @@ static inline int encode_unicode_to_sjis_bytes(uint32_t unicode_code_point, uint
     return 1;
 }
 
-static inline void fallback_to_raw_utf8(const char *utf8_str)
+/**
+ * @brief ISO-8859-15 is ISO-8859-1 with these eight positions reassigned.
+ */
+static const Latin9Substitution LATIN9_SUBSTITUTIONS[LATIN9_SUBSTITUTIONS_LEN] = {
+    {0x20AC, 0xA4},
+    {0x0160, 0xA6},
+    {0x0161, 0xA8},
+    {0x017D, 0xB4},
+    {0x017E, 0xB8},
+    {0x0152, 0xBC},
+    {0x0153, 0xBD},
+    {0x0178, 0xBE}
+};
+
+static inline int encode_latin1_byte(uint32_t code_point)
+{
+    return code_point <= LATIN1_MAX_CODE_POINT ? (int)code_point : BYTE_NOT_ENCODABLE;
+}
+
+static inline int encode_latin9_byte(uint32_t code_point)
+{
+    for (int i = 0; i < LATIN9_SUBSTITUTIONS_LEN; ++i) {
+        if (LATIN9_SUBSTITUTIONS[i].code_point == code_point)
+            return LATIN9_SUBSTITUTIONS[i].byte;
+        if (LATIN9_SUBSTITUTIONS[i].byte == code_point)
+            return BYTE_NOT_ENCODABLE;
+    }
+    return encode_latin1_byte(code_point);
+}
+
+/**
+ * @brief Single-byte charsets tried, in order of preference, before falling back to UTF-8.
+ */
+static const ByteCharset SINGLE_BYTE_CHARSETS[SINGLE_BYTE_CHARSETS_LEN] = {
+    {ECI_ISO_8859_1_DESIGNATOR,  encode_latin1_byte},
+    {ECI_ISO_8859_15_DESIGNATOR, encode_latin9_byte}
+};
+
+static inline bool is_well_formed_utf8(const char *str, int start, int consumed)
+{
+    if (1 == consumed)
+        return (uint8_t)str[start] <= UTF8_1_BYTE_MAX;
+    for (int k = 1; k < consumed; ++k)
+        if (UTF8_CONTINUATION_PREFIX != ((uint8_t)str[start + k] & UTF8_CONTINUATION_TAG_MASK))
+            return false;
+    return true;
+}
+
+/**
+ * @brief Sizes the text in every candidate charset in one scan and returns the cheapest single-byte one, or NULL
+ * when only UTF-8 can carry it.
+ */
+static inline const ByteCharset *select_byte_charset(const char *utf8_str, int len)
+{
+    int encoded_len[SINGLE_BYTE_CHARSETS_LEN] = {0};
+    int input_idx = 0;
+    while (input_idx < len) {
+        int start = input_idx;
+        uint32_t code_point = 0;
+        int consumed = decode_utf8(utf8_str, &input_idx, &code_point);
+        bool is_well_formed = is_well_formed_utf8(utf8_str, start, consumed);
+        for (int k = 0; k < SINGLE_BYTE_CHARSETS_LEN; ++k) {
+            if (!is_well_formed || BYTE_NOT_ENCODABLE == SINGLE_BYTE_CHARSETS[k].encode(code_point))
+                encoded_len[k] = INT32_MAX;
+            else if (INT32_MAX != encoded_len[k])
+                ++encoded_len[k];
+        }
+    }
+    const ByteCharset *cheapest = NULL;
+    int cheapest_len = len;
+    for (int k = 0; k < SINGLE_BYTE_CHARSETS_LEN; ++k) {
+        if (encoded_len[k] < cheapest_len) {
+            cheapest = &SINGLE_BYTE_CHARSETS[k];
+            cheapest_len = encoded_len[k];
+        }
+    }
+    return cheapest;
+}
+
+static inline void encode_single_byte(const char *utf8_str, int len, const ByteCharset *charset)
+{
+    int input_idx = 0;
+    int output_idx = 0;
+    while (input_idx < len && output_idx < MAX_QR_INPUT_LEN) {
+        uint32_t code_point = 0;
+        decode_utf8(utf8_str, &input_idx, &code_point);
+        processed_data[output_idx++] = (uint8_t)charset->encode(code_point);
+    }
+    processed_data_len = output_idx;
+}
+
+static inline void copy_raw_utf8(const char *utf8_str, int len)
 {
-    requires_utf8_eci = true;
     int index = 0;
-    while (NULL_TERMINATOR != utf8_str[index]) {
-        if (index >= MAX_QR_INPUT_LEN)
-            break;
+    while (index < len && index < MAX_QR_INPUT_LEN) {
         processed_data[index] = (uint8_t)utf8_str[index];
         ++index;
     }
     processed_data_len = index;
 }
 
+static inline void encode_without_sjis(const char *utf8_str, int len, const ByteCharset *charset)
+{
+    if (charset) {
+        eci_designator = charset->eci_designator;
+        encode_single_byte(utf8_str, len, charset);
+    } else {
+        eci_designator = ECI_UTF8_DESIGNATOR;
+        copy_raw_utf8(utf8_str, len);
+    }
+}
+
+/**
+ * @brief Appends the code point at input_idx to processed_data, as Shift JIS when it has a mapping and as its own
+ * UTF-8 bytes otherwise. Malformed sequences are passed through one byte at a time.
+ */
+static inline int append_code_point(const char *utf8_str, int *input_idx, int output_idx)
+{
+    int start = *input_idx;
+    uint32_t unicode_code_point = 0;
+    int consumed = decode_utf8(utf8_str, input_idx, &unicode_code_point);
+    bool is_well_formed = is_well_formed_utf8(utf8_str, start, consumed);
+    int bytes_written = is_well_formed ? encode_unicode_to_sjis_bytes(unicode_code_point, &processed_data[output_idx])
+                                       : 0;
+    if (0 != bytes_written) {
+        for (int k = 0; k < bytes_written; ++k) {
+            is_utf8_byte[output_idx + k] = false;
+            source_idx_at[output_idx + k] = start;
+        }
+        return bytes_written;
+    }
+    if (!is_well_formed) {
+        consumed = 1;
+        *input_idx = start + 1;
+    }
+    for (int k = 0; k < consumed; ++k) {
+        processed_data[output_idx + k] = (uint8_t)utf8_str[start + k];
+        is_utf8_byte[output_idx + k] = true;
+        source_idx_at[output_idx + k] = start + k;
+    }
+    return consumed;
+}
+
+/**
+ * @brief Maps the input to Shift JIS where it can in one pass. If anything needs a byte charset instead, the cheapest
+ * one is sized in a single scan and handed straight to the encoder.
+ */
 static inline bool prepare_qr_data(const char *utf8_str)
 {
     kanji_mode_enabled = true;
-    requires_utf8_eci = false;
+    eci_designator = NO_ECI;
+    bool has_utf8_bytes = false;
     int input_idx = 0;
     int output_idx = 0;
     while (NULL_TERMINATOR != utf8_str[input_idx]) {
-        if (output_idx + 2 >= MAX_QR_INPUT_LEN) {
-            kanji_mode_enabled = false;
-            break;
-        }
-        uint32_t unicode_code_point = 0;
-        decode_utf8(utf8_str, &input_idx, &unicode_code_point);
-        int bytes_written = encode_unicode_to_sjis_bytes(unicode_code_point, &processed_data[output_idx]);
-        if (0 == bytes_written) {
+        if (output_idx + UTF8_MAX_SEQUENCE_LEN >= MAX_QR_INPUT_LEN) {
             kanji_mode_enabled = false;
             break;
         }
+        int bytes_written = append_code_point(utf8_str, &input_idx, output_idx);
+        has_utf8_bytes = has_utf8_bytes || is_utf8_byte[output_idx];
         output_idx += bytes_written;
     }
-    if (!kanji_mode_enabled)
-        fallback_to_raw_utf8(utf8_str);
-    else
+    int len = input_idx + wasm_strlen(utf8_str + input_idx);
+    const ByteCharset *charset = NULL;
+    if (!kanji_mode_enabled || has_utf8_bytes)
+        charset = select_byte_charset(utf8_str, len);
+    if (charset)
+        kanji_mode_enabled = false;
+    if (!kanji_mode_enabled) {
+        rt_zero(is_utf8_byte, sizeof(is_utf8_byte));
+        encode_without_sjis(utf8_str, len, charset);
+    } else {
         processed_data_len = output_idx;
+        source_idx_at[output_idx] = input_idx;
+    }
     return kanji_mode_enabled;
 }
 
+static inline void append_eci(int designator)
+{
+    append_bits(ECI_MODE_INDICATOR, MODE_INDICATOR_BITS);
+    append_bits(designator, ECI_DESIGNATOR_BITS);
+}
+
 static inline void process_qr_data(void)
 {
+    if (MASK_STRATEGY_BUDGETED == mask_strategy)
+        encode_started_at = now();
     initialize_gf_tables();
+    STATS_STAGE_BEGIN(STATS_STAGE_ENCODE);
     prepare_qr_data(qr_data);
     int len = processed_data_len;
     const VersionCapacity *vc = determine_version_and_segment(processed_data, len, error_correction_level);
-    if (!vc)
+    if (!vc) {
+        STATS_STAGE_END(STATS_STAGE_ENCODE);
         return;
+    }
     int target_version = vc->version;
     int target_codewords = vc->data_codewords;
     global_bit_offset = 0;
-    wasm_memset(codeword_buffer, 0, sizeof(codeword_buffer));
-    if (requires_utf8_eci) {
-        append_bits(ECI_MODE_INDICATOR, MODE_INDICATOR_BITS);
-        append_bits(ECI_UTF8_DESIGNATOR, ECI_DESIGNATOR_BITS);
-    }
+    rt_zero(codeword_buffer, sizeof(codeword_buffer));
+    int active_eci = eci_designator;
+    if (NO_ECI != eci_designator)
+        append_eci(eci_designator);
     for (int i = 0; i < num_segments; ++i) {
         QRSegment *seg = &segments[i];
+        int segment_eci = get_segment_eci(seg, active_eci);
+        if (segment_eci != active_eci) {
+            append_eci(segment_eci);
+            active_eci = segment_eci;
+        }
         append_bits(seg->mode, MODE_INDICATOR_BITS);
-        append_bits(seg->len, get_cci_bits(seg->mode, target_version));
+        append_bits(get_segment_char_count(seg), get_cci_bits(seg->mode, target_version));
         if (NUMERIC_MODE_INDICATOR == seg->mode)
             numeric_encode_segment_data(processed_data + seg->start, seg->len);
         else if (ALPHANUMERIC_MODE_INDICATOR == seg->mode)
@@ -1789,19 +2389,24 @@ static inline void process_qr_data(void)
         else if (KANJI_MODE_INDICATOR == seg->mode)
             kanji_encode_segment_data(processed_data + seg->start, seg->len);
         else
-            byte_encode_segment_data(processed_data + seg->start, seg->len);
+            byte_encode_segment_data(get_byte_segment_data(seg), get_segment_char_count(seg));
     }
     append_terminator(target_codewords);
     append_padding_bits();
     append_pad_codewords(target_codewords);
+    STATS_STAGE_END(STATS_STAGE_ENCODE);
+    STATS_STAGE_BEGIN(STATS_STAGE_ERROR_CORRECTION);
     generate_interleaved_codewords(codeword_buffer, vc);
+    STATS_STAGE_END(STATS_STAGE_ERROR_CORRECTION);
     int quiet_zone_width = module_size * QUIET_ZONE_MULTIPLIER;
     int version_modules = get_version_modules(target_version);
     int qr_dim = (quiet_zone_width * 2) + (version_modules * module_size);
     canvas_width = qr_dim;
     canvas_height = qr_dim;
-    Canvas c = canvas_create(pixels, canvas_width, canvas_height);
+    STATS_STAGE_BEGIN(STATS_STAGE_RASTER);
+    Canvas c = create_symbol_canvas();
     canvas_fill_rect(&c, 0, 0, canvas_width, canvas_height, C_WHITE);
+    STATS_STAGE_END(STATS_STAGE_RASTER);
     QRContext ctx = {.canvas = &c,
                      .version = target_version,
                      .grid_dim = version_modules,
@@ -1809,13 +2414,12 @@ static inline void process_qr_data(void)
                      .ec_level = error_correction_level,
                      .vc = vc,
                      .mask_pattern = 0};
-    ctx.mask_pattern = apply_best_mask(&ctx);
-    emplace_finder_patterns(&ctx);
-    emplace_timing_patterns(&ctx);
-    emplace_alignment_patterns(&ctx);
-    emplace_format_info(&ctx);
-    emplace_version_info(&ctx);
-    emplace_codewords(&ctx);
+    STATS_STAGE_BEGIN(STATS_STAGE_MASKING);
+    build_module_matrix(&ctx);
+    STATS_STAGE_END(STATS_STAGE_MASKING);
+    STATS_STAGE_BEGIN(STATS_STAGE_RASTER);
+    emplace_modules(&ctx);
+    STATS_STAGE_END(STATS_STAGE_RASTER);
 }
 
 WASM_EXPORT("set_error_correction_level")
@@ -1825,6 +2429,24 @@ void set_error_correction_level(int level)
         error_correction_level = (ErrorCorrectionLevel)level;
 }
 
+/**
+ * @brief Chooses how the mask is selected: MASK_STRATEGY_EXACT scores all eight masks as ISO/IEC 18004 requires,
+ * MASK_STRATEGY_SAMPLED estimates them from a subset of rows and columns, MASK_STRATEGY_FIXED uses mask `param`, and
+ * MASK_STRATEGY_BUDGETED stays exact unless that would exceed `param` microseconds for the render.
+ */
+WASM_EXPORT("set_mask_strategy")
+void set_mask_strategy(int strategy, int param)
+{
+    if (MASK_STRATEGY_FIXED == strategy && (param < 0 || param >= MASK_PATTERN_COUNT))
+        return;
+    if (MASK_STRATEGY_BUDGETED == strategy && param < 0)
+        return;
+    if (strategy < MASK_STRATEGY_EXACT || strategy > MASK_STRATEGY_BUDGETED)
+        return;
+    mask_strategy = strategy;
+    mask_strategy_param = param;
+}
+
 WASM_EXPORT("get_remaining_bits")
 int get_remaining_bits(void)
 {
@@ -1841,9 +2463,45 @@ int get_remaining_bits(void)
     return remaining_bits;
 }
 
+/**
+ * @brief Accepts any payload; one that fits no version is left undrawn by render().
+ */
+bool normalize_data(int len)
+{
+    (void)len;
+    return true;
+}
+
+/**
+ * @brief Capacity dry run: stops after data preparation and version selection, skipping RS, masking and raster.
+ */
+const BarcodeMeasurement *measure(const char *data, int len)
+{
+    qr_data = load_measure_input(data, len);
+    prepare_qr_data(qr_data);
+    const VersionCapacity *vc =
+        determine_version_and_segment(processed_data, processed_data_len, error_correction_level);
+    measurement.segments = num_segments;
+    measurement.remaining_bits = get_remaining_bits();
+    if (!vc) {
+        measurement.used_bits = calculate_total_bits(QR_VERSION_COUNT - 1);
+        return &measurement;
+    }
+    int quiet_zone_width = MODULE_BASE_SIZE * dpr * QUIET_ZONE_MULTIPLIER;
+    int version_modules = get_version_modules(vc->version);
+    measurement.version = vc->version;
+    measurement.used_bits = calculate_total_bits(vc->version);
+    measurement.modules = version_modules;
+    measurement.width = (quiet_zone_width * 2) + (version_modules * MODULE_BASE_SIZE * dpr);
+    measurement.height = measurement.width;
+    return &measurement;
+}
+
 void render(void)
 {
     qr_data = get_data_buffer();
     module_size = MODULE_BASE_SIZE * dpr;
+    STATS_RENDER_BEGIN();
     process_qr_data();
+    STATS_RENDER_END();
 }
@@ -47,6 +47,7 @@ static void check_bits(const char *utf8_string, ErrorCorrectionLevel ec_level, i
     qr_data = utf8_string;
     error_correction_level = ec_level;
     prepare_qr_data(qr_data);
+    classify_input(processed_data, processed_data_len);
     segment_data(processed_data, processed_data_len, 3);
     ASSERT_EQUALS(expected_remaining_bits, get_remaining_bits());
 }
@@ -127,8 +128,7 @@ void error_correction_blocks_for_version_1_m_match_the_iso_standard(void)
     uint8_t expected_ec[10] = {196, 35, 39, 119, 235, 215, 231, 226, 93, 23};
     uint8_t ec[10];
     const uint8_t *g = compute_generator_poly(10);
-    RSBlock block = {.data = data_block, .data_len = 16, .ec = ec, .ec_len = 10};
-    encode_rs_block(&block, g);
+    encode_rs_block(data_block, 16, 10, g, ec, 1);
     ASSERT_MEM_EQUALS(expected_ec, ec, sizeof(expected_ec));
 }
 
@@ -138,20 +138,42 @@ void error_correction_blocks_for_version_40_h_match_the_iso_standard(void)
     uint8_t data_block[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
     uint8_t ec[30];
     const uint8_t *g = compute_generator_poly(30);
-    RSBlock block1 = {.data = data_block, .data_len = 16, .ec = ec, .ec_len = 30};
-    encode_rs_block(&block1, g);
+    encode_rs_block(data_block, 16, 30, g, ec, 1);
     uint8_t codeword[46];
     for (int i = 0; i < 16; ++i)
         codeword[i] = data_block[i];
     for (int i = 0; i < 30; ++i)
         codeword[16 + i] = ec[i];
     uint8_t remainder[30];
-    RSBlock block2 = {.data = codeword, .data_len = 46, .ec = remainder, .ec_len = 30};
-    encode_rs_block(&block2, g);
+    encode_rs_block(codeword, 46, 30, g, remainder, 1);
     uint8_t expected_remainder[30] = {0};
     ASSERT_MEM_EQUALS(expected_remainder, remainder, sizeof(expected_remainder));
 }
 
+void interleaving_places_each_block_at_its_stride(void)
+{
+    initialize_gf_tables();
+    const VersionCapacity *vc = &VERSION_CAPACITIES[18];
+    ASSERT_EQUALS(5, vc->version);
+    ASSERT_EQUALS(EC_Q, vc->ec_level);
+    uint8_t data[62];
+    for (int i = 0; i < 62; ++i)
+        data[i] = (uint8_t)i;
+    generate_interleaved_codewords(data, vc);
+    for (int col = 0; col < 15; ++col) {
+        ASSERT_EQUALS(col, interleaved_codewords[(col * 4) + 0]);
+        ASSERT_EQUALS(15 + col, interleaved_codewords[(col * 4) + 1]);
+        ASSERT_EQUALS(30 + col, interleaved_codewords[(col * 4) + 2]);
+        ASSERT_EQUALS(46 + col, interleaved_codewords[(col * 4) + 3]);
+    }
+    ASSERT_EQUALS(45, interleaved_codewords[60]);
+    ASSERT_EQUALS(61, interleaved_codewords[61]);
+    uint8_t ec[18];
+    encode_rs_block(&data[30], 16, 18, compute_generator_poly(18), ec, 1);
+    for (int col = 0; col < 18; ++col)
+        ASSERT_EQUALS(ec[col], interleaved_codewords[62 + (col * 4) + 2]);
+}
+
 void encodes_pure_kanji_input_using_kanji_mode(void)
 {
     check_bits("\xE7\x82\xB9\xE8\x8C\x97", EC_L, 23606);
@@ -317,10 +339,12 @@ void utf8_eci_fallback_applies_capacity_penalty_at_boundary(void)
 {
     static char edge_case_buffer[8192];
     int offset = 0;
-    for (int i = 0; i < 2950; ++i)
+    for (int i = 0; i < 2948; ++i)
         edge_case_buffer[offset++] = 'a';
-    edge_case_buffer[offset++] = '\xC3';
-    edge_case_buffer[offset++] = '\xA9';
+    edge_case_buffer[offset++] = '\xF0';
+    edge_case_buffer[offset++] = '\x9F';
+    edge_case_buffer[offset++] = '\x9A';
+    edge_case_buffer[offset++] = '\x80';
     edge_case_buffer[offset] = NULL_TERMINATOR;
     qr_data = edge_case_buffer;
     error_correction_level = EC_L;
@@ -340,21 +364,116 @@ void standard_payloads_do_not_trigger_eci_fallback(void)
 {
     qr_data = "hello world 123 \xE7\x82\xB9";
     prepare_qr_data(qr_data);
-    ASSERT_FALSE(requires_utf8_eci);
+    ASSERT_EQUALS(NO_ECI, eci_designator);
 }
 
-void extended_latin_character_triggers_utf8_eci_fallback(void)
+void extended_latin_character_is_encoded_as_iso_8859_1(void)
 {
     qr_data = "caf\xC3\xA9";
     prepare_qr_data(qr_data);
-    ASSERT_TRUE(requires_utf8_eci);
+    ASSERT_EQUALS(ECI_ISO_8859_1_DESIGNATOR, eci_designator);
+    ASSERT_EQUALS(4, processed_data_len);
+    ASSERT_EQUALS(0xE9, processed_data[3]);
+}
+
+void latin_text_outside_iso_8859_1_is_encoded_as_iso_8859_15(void)
+{
+    qr_data = "c\xC5\x93ur \xE2\x82\xAC";
+    prepare_qr_data(qr_data);
+    ASSERT_EQUALS(ECI_ISO_8859_15_DESIGNATOR, eci_designator);
+    ASSERT_EQUALS(6, processed_data_len);
+    ASSERT_EQUALS(0xBD, processed_data[1]);
+    ASSERT_EQUALS(0xA4, processed_data[5]);
 }
 
-void emoji_payload_triggers_utf8_eci_fallback(void)
+void emoji_is_encoded_in_a_utf8_eci_byte_segment(void)
 {
     qr_data = "Hello \xF0\x9F\x9A\x80";
     prepare_qr_data(qr_data);
-    ASSERT_TRUE(requires_utf8_eci);
+    classify_input(processed_data, processed_data_len);
+    segment_data(processed_data, processed_data_len, 1);
+    ASSERT_EQUALS(NO_ECI, eci_designator);
+    ASSERT_EQUALS(1, num_segments);
+    ASSERT_EQUALS(ECI_UTF8_DESIGNATOR, get_segment_eci(&segments[0], NO_ECI));
+}
+
+void kanji_mode_survives_a_character_without_shift_jis_mapping(void)
+{
+    qr_data = "\xE7\x82\xB9\xE8\x8C\x97\xE7\x82\xB9\xE8\x8C\x97\xE7\x82\xB9\xF0\x9F\x9A\x80";
+    prepare_qr_data(qr_data);
+    classify_input(processed_data, processed_data_len);
+    segment_data(processed_data, processed_data_len, 1);
+    ASSERT_TRUE(kanji_mode_enabled);
+    ASSERT_EQUALS(2, num_segments);
+    ASSERT_EQUALS(KANJI_MODE_INDICATOR, segments[0].mode);
+    ASSERT_EQUALS(5, segments[0].len);
+    ASSERT_EQUALS(BYTE_MODE_INDICATOR, segments[1].mode);
+    ASSERT_EQUALS(ECI_UTF8_DESIGNATOR, get_segment_eci(&segments[1], NO_ECI));
+    ASSERT_EQUALS((4 + 8 + (5 * 13)) + (4 + 8) + (4 + 8 + (4 * 8)), calculate_total_bits(1));
+}
+
+static int segment_alternating_characters(char *dest, const char *pair)
+{
+    int len = 0;
+    for (int i = 0; i < 8; ++i) {
+        memcpy(dest + len, pair, 7);
+        len += 7;
+    }
+    dest[len] = NULL_TERMINATOR;
+    qr_data = dest;
+    prepare_qr_data(qr_data);
+    classify_input(processed_data, processed_data_len);
+    segment_data(processed_data, processed_data_len, 1);
+    return len;
+}
+
+void alternating_shift_jis_and_utf8_characters_cost_no_more_than_plain_utf8(void)
+{
+    static char alternating[64];
+    int len = segment_alternating_characters(alternating, "\xEF\xBD\xB1\xF0\x9F\x98\x80");
+    int plain_utf8_bits = (MODE_INDICATOR_BITS + ECI_DESIGNATOR_BITS) + MODE_INDICATOR_BITS + CCI_BITS_BYTE_V1_9 +
+                          (len * BITS_PER_BYTE);
+    ASSERT_TRUE(calculate_total_bits(1) <= plain_utf8_bits);
+    len = segment_alternating_characters(alternating, "\xF0\x9F\x98\x80\xEF\xBD\xB1");
+    ASSERT_EQUALS(1, num_segments);
+    ASSERT_EQUALS(plain_utf8_bits, calculate_total_bits(1));
+    error_correction_level = EC_M;
+    process_qr_data();
+    ASSERT_EQUALS(0x71, codeword_buffer[0]);
+    ASSERT_EQUALS(0xA4, codeword_buffer[1]);
+    ASSERT_EQUALS(len, codeword_buffer[2]);
+    ASSERT_TRUE(0 == memcmp(codeword_buffer + 3, alternating, (size_t)len));
+}
+
+void long_shift_jis_byte_run_keeps_its_own_segment_before_utf8(void)
+{
+    static char mixed[64];
+    int len = 0;
+    for (int i = 0; i < 10; ++i) {
+        memcpy(mixed + len, "\xEF\xBD\xB1", 3);
+        len += 3;
+    }
+    memcpy(mixed + len, "\xF0\x9F\x98\x80", 5);
+    qr_data = mixed;
+    prepare_qr_data(qr_data);
+    classify_input(processed_data, processed_data_len);
+    segment_data(processed_data, processed_data_len, 1);
+    ASSERT_EQUALS(2, num_segments);
+    ASSERT_EQUALS(10, segments[0].len);
+    ASSERT_EQUALS(NO_ECI, get_segment_eci(&segments[0], NO_ECI));
+    ASSERT_EQUALS(ECI_UTF8_DESIGNATOR, get_segment_eci(&segments[1], NO_ECI));
+    ASSERT_EQUALS((4 + 8 + (10 * 8)) + (4 + 8) + (4 + 8 + (4 * 8)), calculate_total_bits(1));
+}
+
+void mode_switches_costlier_than_plain_utf8_collapse_into_one_segment(void)
+{
+    static char mixed[] = " \xE8\x8C\x97\xF0\x9F\x98\x80";
+    qr_data = mixed;
+    prepare_qr_data(qr_data);
+    ASSERT_EQUALS(1, determine_version_and_segment(processed_data, processed_data_len, EC_M)->version);
+    ASSERT_EQUALS(1, num_segments);
+    ASSERT_EQUALS(SEGMENT_CHARSET_UTF8, segments[0].charset);
+    ASSERT_EQUALS((4 + 8) + (4 + 8 + (8 * 8)), calculate_total_bits(1));
 }
 
 void massive_utf8_payload_is_rejected_without_memory_corruption(void)
@@ -374,6 +493,265 @@ void massive_utf8_payload_is_rejected_without_memory_corruption(void)
     ASSERT_TRUE(true);
 }
 
+void measure_reports_the_version_and_canvas_size_that_render_produces(void)
+{
+    static const char payload[] = "HELLO WORLD 0123456789";
+    error_correction_level = EC_M;
+    dpr = 2;
+    const BarcodeMeasurement *m = measure(payload, (int)strlen(payload));
+    int measured_version = m->version;
+    int measured_width = m->width;
+    int measured_remaining_bits = m->remaining_bits;
+    ASSERT_TRUE(measured_version > 0);
+    ASSERT_EQUALS(get_version_modules(measured_version), m->modules);
+    render();
+    ASSERT_EQUALS(canvas_width, measured_width);
+    ASSERT_EQUALS(canvas_height, measured_width);
+    ASSERT_EQUALS(get_remaining_bits(), measured_remaining_bits);
+    dpr = 1;
+}
+
+void measure_reports_no_version_when_data_does_not_fit(void)
+{
+    static char oversized[8000];
+    for (int i = 0; i < 7999; ++i)
+        oversized[i] = 'a';
+    error_correction_level = EC_H;
+    const BarcodeMeasurement *m = measure(oversized, 7999);
+    ASSERT_EQUALS(0, m->version);
+    ASSERT_TRUE(m->remaining_bits < 0);
+    int measured_remaining_bits = m->remaining_bits;
+    load_data_buffer(oversized, 7999);
+    ASSERT_FALSE(render_into(pixels, get_pixel_capacity()));
+    ASSERT_EQUALS(measured_remaining_bits, get_remaining_bits());
+}
+
+static int find_matching_fixed_mask(const uint32_t *rendered, uint32_t fixed_renders[][160 * 160], size_t pixel_count)
+{
+    for (int mask = 0; mask < MASK_PATTERN_COUNT; ++mask)
+        if (0 == memcmp(rendered, fixed_renders[mask], pixel_count * sizeof(uint32_t)))
+            return mask;
+    return -1;
+}
+
+void mask_strategies_render_one_of_the_eight_masks(void)
+{
+    static const char payload[] = "MASK STRATEGY 42";
+    static uint32_t fixed_renders[MASK_PATTERN_COUNT][160 * 160];
+    static uint32_t rendered[160 * 160];
+    size_t capacity = sizeof(rendered) / sizeof(rendered[0]);
+    error_correction_level = EC_M;
+    load_data_buffer(payload, (int)strlen(payload));
+    for (int mask = 0; mask < MASK_PATTERN_COUNT; ++mask) {
+        set_mask_strategy(MASK_STRATEGY_FIXED, mask);
+        ASSERT_TRUE(render_into(fixed_renders[mask], capacity));
+    }
+    size_t pixel_count = (size_t)canvas_width * (size_t)canvas_height;
+    set_mask_strategy(MASK_STRATEGY_EXACT, 0);
+    ASSERT_TRUE(render_into(rendered, capacity));
+    int exact_mask = find_matching_fixed_mask(rendered, fixed_renders, pixel_count);
+    ASSERT_TRUE(exact_mask >= 0);
+    set_mask_strategy(MASK_STRATEGY_BUDGETED, INT32_MAX);
+    ASSERT_TRUE(render_into(rendered, capacity));
+    ASSERT_EQUALS(exact_mask, find_matching_fixed_mask(rendered, fixed_renders, pixel_count));
+    set_mask_strategy(MASK_STRATEGY_SAMPLED, 0);
+    ASSERT_TRUE(render_into(rendered, capacity));
+    ASSERT_TRUE(find_matching_fixed_mask(rendered, fixed_renders, pixel_count) >= 0);
+    set_mask_strategy(MASK_STRATEGY_EXACT, 0);
+}
+
+void mask_planes_cover_exactly_the_masked_data_modules(void)
+{
+    int version = 7;
+    int grid_dim = get_version_modules(version);
+    cache_placement_order(version, grid_dim);
+    for (int mask = 0; mask < MASK_PATTERN_COUNT; ++mask) {
+        PlaneRow *plane = get_mask_plane(mask);
+        for (int row = 0; row < grid_dim; ++row) {
+            for (int col = 0; col < grid_dim; ++col) {
+                bool is_masked = !is_reserved_position(row, col, version, grid_dim) &&
+                                 TIMING_PATTERN_COORD != col && evaluate_mask_condition(mask, row, col);
+                uint64_t bit = (plane[row][col / PLANE_WORD_BITS] >> (col % PLANE_WORD_BITS)) & 1;
+                ASSERT_EQUALS(is_masked, 1 == bit);
+            }
+        }
+    }
+}
+
+static const char *const MASKING_PAYLOADS[] = {
+    "MASK STRATEGY 42", "https://example.com/?q=0123456789",
+    "The quick brown fox jumps over the lazy dog; the five boxing wizards jump quickly. 0123456789"};
+
+static const ErrorCorrectionLevel MASKING_EC_LEVELS[] = {EC_L, EC_H};
+
+static QRContext build_masking_context(const char *payload, ErrorCorrectionLevel ec_level)
+{
+    qr_data = payload;
+    error_correction_level = ec_level;
+    process_qr_data();
+    const VersionCapacity *vc = determine_version_and_segment(processed_data, processed_data_len, ec_level);
+    QRContext ctx = {.version = vc->version,
+                     .grid_dim = get_version_modules(vc->version),
+                     .ec_level = ec_level,
+                     .vc = vc,
+                     .mask_pattern = 0};
+    build_base_grid(&ctx);
+    return ctx;
+}
+
+static int find_argmin_mask(QRContext *ctx, int *penalties)
+{
+    int argmin = 0;
+    for (int mask = 0; mask < MASK_PATTERN_COUNT; ++mask) {
+        ctx->mask_pattern = mask;
+        penalties[mask] = score_mask(ctx, INT32_MAX);
+        if (penalties[mask] < penalties[argmin])
+            argmin = mask;
+    }
+    return argmin;
+}
+
+void bounded_mask_search_picks_the_argmin_of_the_full_penalties(void)
+{
+    for (size_t p = 0; p < sizeof(MASKING_PAYLOADS) / sizeof(MASKING_PAYLOADS[0]); ++p) {
+        for (size_t e = 0; e < sizeof(MASKING_EC_LEVELS) / sizeof(MASKING_EC_LEVELS[0]); ++e) {
+            QRContext ctx = build_masking_context(MASKING_PAYLOADS[p], MASKING_EC_LEVELS[e]);
+            int penalties[MASK_PATTERN_COUNT];
+            int argmin = find_argmin_mask(&ctx, penalties);
+            ASSERT_EQUALS(argmin, find_optimal_mask(&ctx));
+        }
+    }
+}
+
+void mask_strategies_select_masks_by_their_scored_penalties(void)
+{
+    for (size_t p = 0; p < sizeof(MASKING_PAYLOADS) / sizeof(MASKING_PAYLOADS[0]); ++p) {
+        for (size_t e = 0; e < sizeof(MASKING_EC_LEVELS) / sizeof(MASKING_EC_LEVELS[0]); ++e) {
+            QRContext ctx = build_masking_context(MASKING_PAYLOADS[p], MASKING_EC_LEVELS[e]);
+            int penalties[MASK_PATTERN_COUNT];
+            int argmin = find_argmin_mask(&ctx, penalties);
+            set_mask_strategy(MASK_STRATEGY_EXACT, 0);
+            ASSERT_EQUALS(penalties[argmin], penalties[select_mask(&ctx)]);
+            int best_mask = 0;
+            int runner_up_mask = -1;
+            int estimates[MASK_PATTERN_COUNT];
+            for (int mask = 0; mask < MASK_PATTERN_COUNT; ++mask) {
+                ctx.mask_pattern = mask;
+                estimates[mask] = score_mask_sampled(&ctx);
+                if (estimates[mask] < estimates[best_mask]) {
+                    runner_up_mask = best_mask;
+                    best_mask = mask;
+                } else if (mask != best_mask && (runner_up_mask < 0 || estimates[mask] < estimates[runner_up_mask])) {
+                    runner_up_mask = mask;
+                }
+            }
+            set_mask_strategy(MASK_STRATEGY_SAMPLED, 0);
+            int sampled_mask = select_mask(&ctx);
+            ASSERT_TRUE(sampled_mask == best_mask || sampled_mask == runner_up_mask);
+            ASSERT_EQUALS(MATH_MIN(penalties[best_mask], penalties[runner_up_mask]), penalties[sampled_mask]);
+            set_mask_strategy(MASK_STRATEGY_BUDGETED, 0);
+            ASSERT_EQUALS(sampled_mask, select_mask(&ctx));
+            set_mask_strategy(MASK_STRATEGY_EXACT, 0);
+        }
+    }
+}
+
+static uint8_t reference_matrix[MAX_QR_MODULES][MAX_QR_MODULES];
+
+static void plot_reference_square(int top, int left, int size, int light_ring)
+{
+    int center = size / 2;
+    for (int row = 0; row < size; ++row) {
+        for (int col = 0; col < size; ++col) {
+            int ring = MATH_MAX(MATH_ABS(row - center), MATH_ABS(col - center));
+            reference_matrix[top + row][left + col] = light_ring != ring;
+        }
+    }
+}
+
+/**
+ * @brief Lays the symbol out module by module in the order the renderer used to paint it: finders, timing,
+ * alignment, format info, version info, then the masked codewords along a fresh zigzag walk.
+ */
+static void build_reference_matrix(const QRContext *ctx)
+{
+    int dim = ctx->grid_dim;
+    rt_zero(reference_matrix, sizeof(reference_matrix));
+    plot_reference_square(0, 0, FINDER_PATTERN_SIZE, 2);
+    plot_reference_square(0, dim - FINDER_PATTERN_SIZE, FINDER_PATTERN_SIZE, 2);
+    plot_reference_square(dim - FINDER_PATTERN_SIZE, 0, FINDER_PATTERN_SIZE, 2);
+    for (int i = FINDER_PATTERN_AREA_SIZE; i <= dim - TIMING_PATTERN_END_MARGIN; ++i) {
+        reference_matrix[TIMING_PATTERN_COORD][i] = 0 == i % 2;
+        reference_matrix[i][TIMING_PATTERN_COORD] = 0 == i % 2;
+    }
+    if (NO_ALIGNMENT_VERSION != ctx->version) {
+        const int *coords = ALIGNMENT_PATTERN_COORDS[ctx->version];
+        int coord_count = get_alignment_coords_count(coords);
+        for (int i = 0; i < coord_count; ++i)
+            for (int j = 0; j < coord_count; ++j)
+                if (!is_overlapping_finder_pattern(coords[i], coords[j], dim))
+                    plot_reference_square(coords[i] - ALIGNMENT_PATTERN_CENTER_OFFSET,
+                                          coords[j] - ALIGNMENT_PATTERN_CENTER_OFFSET, 5, 1);
+    }
+    int format_bits = get_format_info(ctx->ec_level, ctx->mask_pattern);
+    reference_matrix[dim - FORMAT_INFO_COORD][FORMAT_INFO_COORD] = 1;
+    for (int i = 0; i < FORMAT_INFO_BITS; ++i) {
+        uint8_t bit = (uint8_t)((format_bits >> i) & 1);
+        reference_matrix[FORMAT_INFO_ROW[i]][FORMAT_INFO_COL[i]] = bit;
+        if (i < 8)
+            reference_matrix[FORMAT_INFO_COORD][dim - 1 - i] = bit;
+        else
+            reference_matrix[dim - FORMAT_INFO_BITS + i][FORMAT_INFO_COORD] = bit;
+    }
+    if (ctx->version >= VERSION_INFO_MIN_VERSION) {
+        int version_bits = get_version_info(ctx->version);
+        for (int i = 0; i < VERSION_INFO_BITS; ++i) {
+            uint8_t bit = (uint8_t)((version_bits >> i) & 1);
+            reference_matrix[i / 3][dim - VERSION_INFO_EDGE_OFFSET + (i % 3)] = bit;
+            reference_matrix[dim - VERSION_INFO_EDGE_OFFSET + (i % 3)][i / 3] = bit;
+        }
+    }
+    int total_bits = ((ctx->vc->num_blocks_g1 * ctx->vc->c_g1) + (ctx->vc->num_blocks_g2 * ctx->vc->c_g2)) *
+                     BITS_PER_BYTE;
+    int placed_bits = 0;
+    int row, col;
+    QRZigZag zz = zigzag_create(dim, ctx->version);
+    while (next_zigzag_coord(&zz, &row, &col)) {
+        bool is_dark = false;
+        if (placed_bits < total_bits)
+            is_dark = (interleaved_codewords[placed_bits / BITS_PER_BYTE] >> (7 - (placed_bits % BITS_PER_BYTE))) & 1;
+        reference_matrix[row][col] = is_dark != evaluate_mask_condition(ctx->mask_pattern, row, col);
+        ++placed_bits;
+    }
+}
+
+void single_sweep_matrix_matches_module_by_module_placement(void)
+{
+    bool has_version_info = false;
+    for (size_t p = 0; p < sizeof(MASKING_PAYLOADS) / sizeof(MASKING_PAYLOADS[0]); ++p) {
+        for (size_t e = 0; e < sizeof(MASKING_EC_LEVELS) / sizeof(MASKING_EC_LEVELS[0]); ++e) {
+            for (int mask = 0; mask < MASK_PATTERN_COUNT; ++mask) {
+                set_mask_strategy(MASK_STRATEGY_FIXED, mask);
+                QRContext ctx = build_masking_context(MASKING_PAYLOADS[p], MASKING_EC_LEVELS[e]);
+                ctx.mask_pattern = mask;
+                has_version_info = has_version_info || ctx.version >= VERSION_INFO_MIN_VERSION;
+                build_reference_matrix(&ctx);
+                int quiet_zone_width = module_size * QUIET_ZONE_MULTIPLIER;
+                for (int row = 0; row < ctx.grid_dim; ++row) {
+                    for (int col = 0; col < ctx.grid_dim; ++col) {
+                        int y = quiet_zone_width + (row * module_size);
+                        int x = quiet_zone_width + (col * module_size);
+                        uint32_t expected = reference_matrix[row][col] ? C_BLACK : C_WHITE;
+                        ASSERT_EQUALS(expected, pixels[(y * canvas_width) + x]);
+                    }
+                }
+            }
+        }
+    }
+    ASSERT_TRUE(has_version_info);
+    set_mask_strategy(MASK_STRATEGY_EXACT, 0);
+}
+
 int main(void)
 {
     TestCase qr_tests[] = {TEST_FUNC(determines_correct_version_for_sizes_1_to_9),
@@ -385,6 +763,7 @@ int main(void)
                            TEST_FUNC(generator_polynomial_of_degree_68_matches_the_iso_standard),
                            TEST_FUNC(error_correction_blocks_for_version_1_m_match_the_iso_standard),
                            TEST_FUNC(error_correction_blocks_for_version_40_h_match_the_iso_standard),
+                           TEST_FUNC(interleaving_places_each_block_at_its_stride),
                            TEST_FUNC(encodes_pure_kanji_input_using_kanji_mode),
                            TEST_FUNC(transitions_from_alphanumeric_to_kanji_mode_when_kanji_is_encountered),
                            TEST_FUNC(retains_byte_mode_when_kanji_sequence_is_too_short_for_optimization),
@@ -409,9 +788,21 @@ int main(void)
                            TEST_FUNC(kanji_capacity_is_strictly_enforced_at_ec_h),
                            TEST_FUNC(utf8_eci_fallback_applies_capacity_penalty_at_boundary),
                            TEST_FUNC(standard_payloads_do_not_trigger_eci_fallback),
-                           TEST_FUNC(extended_latin_character_triggers_utf8_eci_fallback),
-                           TEST_FUNC(emoji_payload_triggers_utf8_eci_fallback),
-                           TEST_FUNC(massive_utf8_payload_is_rejected_without_memory_corruption)};
+                           TEST_FUNC(extended_latin_character_is_encoded_as_iso_8859_1),
+                           TEST_FUNC(latin_text_outside_iso_8859_1_is_encoded_as_iso_8859_15),
+                           TEST_FUNC(emoji_is_encoded_in_a_utf8_eci_byte_segment),
+                           TEST_FUNC(kanji_mode_survives_a_character_without_shift_jis_mapping),
+                           TEST_FUNC(alternating_shift_jis_and_utf8_characters_cost_no_more_than_plain_utf8),
+                           TEST_FUNC(long_shift_jis_byte_run_keeps_its_own_segment_before_utf8),
+                           TEST_FUNC(mode_switches_costlier_than_plain_utf8_collapse_into_one_segment),
+                           TEST_FUNC(massive_utf8_payload_is_rejected_without_memory_corruption),
+                           TEST_FUNC(measure_reports_the_version_and_canvas_size_that_render_produces),
+                           TEST_FUNC(measure_reports_no_version_when_data_does_not_fit),
+                           TEST_FUNC(mask_strategies_render_one_of_the_eight_masks),
+                           TEST_FUNC(mask_planes_cover_exactly_the_masked_data_modules),
+                           TEST_FUNC(bounded_mask_search_picks_the_argmin_of_the_full_penalties),
+                           TEST_FUNC(mask_strategies_select_masks_by_their_scored_penalties),
+                           TEST_FUNC(single_sweep_matrix_matches_module_by_module_placement)};
     RUN_TEST_SUITE("qr_code.c", qr_tests);
     return 0;
 }
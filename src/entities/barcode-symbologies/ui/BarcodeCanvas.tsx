@@ -1,9 +1,16 @@
-import { type JSX, type RefObject, use, useCallback, useEffect } from 'react';
 import {
-  type BaseBarcodeWasm,
-  fetchBarcodeWasm,
-  isMatrix2DBarcodeWasm,
-} from '../lib/barcode-wasm.ts';
+  type JSX,
+  type RefObject,
+  use,
+  useCallback,
+  useEffect,
+  useState,
+} from 'react';
+import {
+  attachBarcodeCanvas,
+  loadBarcodeSymbology,
+  requestBarcodeRender,
+} from '../lib/barcode-renderer.ts';
 import {
   DEFAULT_FONT,
   type RasterizedFont,
@@ -24,8 +31,6 @@ interface BarcodeCanvasProps {
   onProcessComplete: (remainingBits: number, evaluatedText: string) => void;
 }
 
-const TEXT_ENCODER = new TextEncoder();
-
 let cachedSystemFont: RasterizedFont | null = null;
 
 function getSystemFont() {
@@ -35,27 +40,6 @@ function getSystemFont() {
   return cachedSystemFont;
 }
 
-function evaluateBarcodeText(
-  originalText: string,
-  barcodeWasm: BaseBarcodeWasm,
-  maxInputLength: number,
-): { currentBits: number; validText: string } {
-  const inputPtr = barcodeWasm.get_data_buffer();
-  const wasmMem = new Uint8Array(barcodeWasm.memory.buffer);
-  const testTextInWasm = (text: string): number => {
-    const encodedText = TEXT_ENCODER.encode(text);
-    wasmMem.set(encodedText, inputPtr);
-    wasmMem[inputPtr + encodedText.length] = 0;
-    barcodeWasm.render();
-    if (isMatrix2DBarcodeWasm(barcodeWasm)) {
-      return barcodeWasm.get_remaining_bits();
-    }
-    return (maxInputLength - text.length) * 8;
-  };
-  const currentBits = testTextInWasm(originalText);
-  return { currentBits, validText: originalText };
-}
-
 function formatBarcodeText(
   text: string,
   pattern: string,
@@ -87,61 +71,58 @@ function BarcodeCanvas({
   const { allowedPattern, maxInputLength, rightPaddingChar, type, wasmFile } =
     currentSymbology;
 
-  const barcodeWasm = use(fetchBarcodeWasm(wasmFile, type));
+  use(loadBarcodeSymbology(wasmFile, type));
+
+  const [renderError, setRenderError] = useState<unknown>(null);
 
   const renderBarcode = useCallback(() => {
     const canvas = canvasRef.current;
     if (!canvas) return;
-    const ctx = canvas.getContext('2d');
-    if (!ctx) return;
+    attachBarcodeCanvas(canvas);
     const textToRender = formatBarcodeText(
       inputText,
       allowedPattern,
       maxInputLength,
       rightPaddingChar,
     );
-    const fontToUse = getSystemFont();
-    const wasmMem = new Uint8Array(barcodeWasm.memory.buffer);
-    const widthsPtr = barcodeWasm.get_custom_font_widths_buffer();
-    wasmMem.set(fontToUse.widths, widthsPtr);
-    const glyphsPtr = barcodeWasm.get_custom_font_glyphs_buffer();
-    wasmMem.set(fontToUse.glyphs, glyphsPtr);
-    barcodeWasm.set_dpr(dpr);
-    if (isMatrix2DBarcodeWasm(barcodeWasm)) {
-      barcodeWasm.set_error_correction_level(+selectedErrorCorrectionLevel);
-    }
-    const { currentBits, validText } = evaluateBarcodeText(
-      textToRender,
-      barcodeWasm,
+    let isCurrent = true;
+    requestBarcodeRender({
+      dpr,
+      errorCorrectionLevel: +selectedErrorCorrectionLevel,
+      font: getSystemFont(),
       maxInputLength,
-    );
-    const width = barcodeWasm.get_width();
-    const height = barcodeWasm.get_height();
-    canvas.width = width;
-    canvas.height = height;
-    canvas.style.width = `${width / dpr}px`;
-    const pixelPtr = barcodeWasm.get_pixel_buffer();
-    const pixelData = new Uint8ClampedArray(
-      barcodeWasm.memory.buffer,
-      pixelPtr,
-      width * height * 4,
-    );
-    ctx.putImageData(new ImageData(pixelData, width, height), 0, 0);
-    onProcessComplete(currentBits, validText);
+      text: textToRender,
+      type,
+      wasmFile,
+    })
+      .then((result) => {
+        if (!(isCurrent && result)) return;
+        canvas.style.width = `${result.width / dpr}px`;
+        onProcessComplete(result.currentBits, result.validText);
+      })
+      .catch((error: unknown) => setRenderError(() => error));
+    return () => {
+      isCurrent = false;
+    };
   }, [
     allowedPattern,
-    barcodeWasm,
     canvasRef,
     dpr,
     inputText,
     maxInputLength,
     rightPaddingChar,
     selectedErrorCorrectionLevel,
+    type,
+    wasmFile,
     onProcessComplete,
   ]);
 
   useEffect(() => renderBarcode(), [renderBarcode]);
 
+  if (renderError !== null) {
+    throw renderError;
+  }
+
   return <canvas ref={canvasRef} className={styles.canvas} />;
 }
 
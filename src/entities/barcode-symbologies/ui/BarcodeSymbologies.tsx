@@ -12,6 +12,10 @@ import type { ReadonlyDeep } from 'type-fest';
 import type { Option } from '@/shared/model/option.ts';
 import ButtonWithOptions from '@/shared/ui/ButtonWithOptions/ButtonWithOptions.tsx';
 import DownloadIcon from '@/shared/ui/DownloadIcon/DownloadIcon.tsx';
+import {
+  exportBarcodeImage,
+  loadBarcodeSymbology,
+} from '../lib/barcode-renderer.ts';
 import { DEFAULT_FONT } from '../lib/font-rasterizer.ts';
 import {
   assertIsBarcodeSymbology,
@@ -37,6 +41,11 @@ const DOWNLOAD_FORMAT_OPTIONS: ReadonlyDeep<Option[]> = [
   { label: 'WebP', value: 'webp' },
 ];
 
+if (typeof window !== 'undefined') {
+  const { type, wasmFile } = BARCODE_SYMBOLOGIES[INITIAL_SYMBOLOGY];
+  loadBarcodeSymbology(wasmFile, type).catch(() => undefined);
+}
+
 function calculateModeCapacity(
   remainingBits: number,
   textLength: number,
@@ -241,24 +250,17 @@ function BarcodeSymbologies(): JSX.Element {
     setSelectedErrorCorrectionLevel(newLevel);
   };
 
-  const handleDownload = () => {
-    const canvas = canvasRef.current;
-    if (!canvas) return;
-    canvas.toBlob(
-      (blob) => {
-        if (!blob) return;
-        const url = URL.createObjectURL(blob);
-        const link = document.createElement('a');
-        link.href = url;
-        link.download = `${currentSymbology.value}.${selectedFormat.value}`;
-        document.body.appendChild(link);
-        link.click();
-        document.body.removeChild(link);
-        URL.revokeObjectURL(url);
-      },
-      `image/${selectedFormat.value}`,
-      1.0,
-    );
+  const handleDownload = async () => {
+    const blob = await exportBarcodeImage(`image/${selectedFormat.value}`, 1.0);
+    if (!blob) return;
+    const url = URL.createObjectURL(blob);
+    const link = document.createElement('a');
+    link.href = url;
+    link.download = `${currentSymbology.value}.${selectedFormat.value}`;
+    document.body.appendChild(link);
+    link.click();
+    document.body.removeChild(link);
+    URL.revokeObjectURL(url);
   };
 
   return (
@@ -1,8 +1,13 @@
 #include "graphics.h"
+#include "runtime.h"
 
 #include <stdbool.h>
 #include <stddef.h>
 
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
 #define NO_BORDER 0
 
 #define CLAMP(val, min, max) (((val) < (min)) ? (min) : (((val) > (max)) ? (max) : (val)))
@@ -14,13 +19,40 @@
         (b) = t;                                                                                                       \
     } while (0)
 
+#ifdef GRAPHICS_STATS
+static CanvasStats canvas_stats;
+#define CANVAS_STATS_ADD(field, n) (canvas_stats.field += (uint32_t)(n))
+#else
+#define CANVAS_STATS_ADD(field, n) ((void)0)
+#endif
+
 Canvas canvas_create(uint32_t *pixels, int width, int height)
 {
     if (width <= 0 || height <= 0)
         return CANVAS_NULL;
     if (NULL == pixels)
         return CANVAS_NULL;
-    return (Canvas){.pixels = pixels, .width = width, .height = height};
+    return (Canvas){.pixels = pixels, .width = width, .height = height, .stride = width};
+}
+
+/**
+ * @brief A view of the given rectangle of parent, clipped to it. Drawing into the view writes through to the
+ * parent's pixels and never outside the view.
+ */
+Canvas canvas_subview(const Canvas *parent, int x, int y, int width, int height)
+{
+    if (NULL == parent->pixels || width <= 0 || height <= 0)
+        return CANVAS_NULL;
+    int x0 = CLAMP(x, 0, parent->width);
+    int y0 = CLAMP(y, 0, parent->height);
+    int x1 = CLAMP(x + width, 0, parent->width);
+    int y1 = CLAMP(y + height, 0, parent->height);
+    if (x1 <= x0 || y1 <= y0)
+        return CANVAS_NULL;
+    return (Canvas){.pixels = parent->pixels + (y0 * parent->stride) + x0,
+                    .width = x1 - x0,
+                    .height = y1 - y0,
+                    .stride = parent->stride};
 }
 
 void canvas_fill_rect(Canvas *self, int x0, int y0, int width, int height, uint32_t color)
@@ -39,11 +71,14 @@ void canvas_fill_rect(Canvas *self, int x0, int y0, int width, int height, uint3
     y1 = CLAMP(y1, 0, self->height);
     if (x1 == x0 || y1 == y0)
         return;
-    for (int y = y0; y < y1; ++y) {
-        uint32_t *row = self->pixels + (y * self->width);
-        for (int x = x0; x < x1; ++x)
-            row[x] = color;
+    CANVAS_STATS_ADD(fill_rect_calls, 1);
+    CANVAS_STATS_ADD(pixels_written, (x1 - x0) * (y1 - y0));
+    if (x1 - x0 == self->stride) {
+        rt_fill32(self->pixels + (y0 * self->stride), color, (size_t)(y1 - y0) * (size_t)self->stride);
+        return;
     }
+    for (int y = y0; y < y1; ++y)
+        rt_fill32(self->pixels + (y * self->stride) + x0, color, (size_t)(x1 - x0));
 }
 
 void canvas_stroke_rect(Canvas *self, int x0, int y0, int width, int height, int border, uint32_t color)
@@ -83,12 +118,24 @@ static inline uint32_t canvas_blend_color(uint32_t fg, uint32_t bg, float alpha)
         return bg;
     if (alpha >= 1.0f)
         return fg;
+#ifdef __wasm_simd128__
+    v128_t fg_rgba = wasm_f32x4_convert_u32x4(
+        wasm_u32x4_extend_low_u16x8(wasm_u16x8_extend_low_u8x16(wasm_i32x4_splat((int32_t)fg))));
+    v128_t bg_rgba = wasm_f32x4_convert_u32x4(
+        wasm_u32x4_extend_low_u16x8(wasm_u16x8_extend_low_u8x16(wasm_i32x4_splat((int32_t)bg))));
+    v128_t blended = wasm_f32x4_add(bg_rgba, wasm_f32x4_mul(wasm_f32x4_sub(fg_rgba, bg_rgba), wasm_f32x4_splat(alpha)));
+    v128_t blended_u32 = wasm_u32x4_trunc_sat_f32x4(blended);
+    v128_t blended_u16 = wasm_u16x8_narrow_i32x4(blended_u32, blended_u32);
+    v128_t blended_u8 = wasm_u8x16_narrow_i16x8(blended_u16, blended_u16);
+    return ((uint32_t)wasm_i32x4_extract_lane(blended_u8, 0) & 0x00FFFFFF) | RGBA(0, 0, 0, 255);
+#else
     uint32_t r_fg = fg & 0xFF, g_fg = (fg >> 8) & 0xFF, b_fg = (fg >> 16) & 0xFF;
     uint32_t r_bg = bg & 0xFF, g_bg = (bg >> 8) & 0xFF, b_bg = (bg >> 16) & 0xFF;
     uint32_t r = (uint32_t)((float)r_bg + (((float)r_fg - (float)r_bg) * alpha));
     uint32_t g = (uint32_t)((float)g_bg + (((float)g_fg - (float)g_bg) * alpha));
     uint32_t b = (uint32_t)((float)b_bg + (((float)b_fg - (float)b_bg) * alpha));
     return RGBA(r, g, b, 255);
+#endif
 }
 
 static inline float apply_adaptive_sharpening(float bilinear_alpha, float scale)
@@ -159,7 +206,7 @@ static inline void draw_glyph_pixel(Canvas *canvas, const uint8_t *glyph, int fo
     float bilinear_alpha = compose_bilinear_alpha(glyph, font_size, src_x, src_y);
     float alpha = apply_adaptive_sharpening(bilinear_alpha, scale);
     if (alpha > 0.0f) {
-        uint32_t *pixel = &canvas->pixels[(canvas_y * canvas->width) + canvas_x];
+        uint32_t *pixel = &canvas->pixels[(canvas_y * canvas->stride) + canvas_x];
         *pixel = canvas_blend_color(color, *pixel, alpha);
     }
 }
@@ -171,6 +218,7 @@ static void draw_single_glyph(Canvas *canvas, const uint8_t *glyph, int font_siz
     float fract_x = start_x - (float)base_x;
     int scaled_width = (int)((float)font_size * scale) + 1;
     int scaled_height = (int)((float)font_size * scale) + 1;
+    CANVAS_STATS_ADD(glyphs_drawn, 1);
     for (int dy = 0; dy < scaled_height; ++dy) {
         for (int dx = 0; dx < scaled_width; ++dx) {
             int canvas_x = base_x + dx;
@@ -202,3 +250,15 @@ void canvas_draw_text(Canvas *self, const char *text, int text_x, int text_y, Ca
         current_x += scaled_advance;
     }
 }
+
+#ifdef GRAPHICS_STATS
+CanvasStats *canvas_get_stats(void)
+{
+    return &canvas_stats;
+}
+
+void canvas_reset_stats(void)
+{
+    canvas_stats = (CanvasStats){0};
+}
+#endif
@@ -13,12 +13,24 @@
 #define C_BLACK RGBA(0, 0, 0, 255)
 #define C_WHITE RGBA(255, 255, 255, 255)
 
+/**
+ * @brief A rectangle of pixels. Rows are stride pixels apart, so a canvas may be a view into a larger one.
+ */
 typedef struct {
     uint32_t *pixels;
     int width;
     int height;
+    int stride;
 } Canvas;
 
+#ifdef GRAPHICS_STATS
+typedef struct {
+    uint32_t fill_rect_calls;
+    uint32_t pixels_written;
+    uint32_t glyphs_drawn;
+} CanvasStats;
+#endif
+
 typedef struct {
     int size;
     const uint8_t *widths;
@@ -26,6 +38,7 @@ typedef struct {
 } CanvasFont;
 
 Canvas canvas_create(uint32_t *pixels, int width, int height);
+Canvas canvas_subview(const Canvas *parent, int x, int y, int width, int height);
 void canvas_fill_rect(Canvas *self, int x0, int y0, int width, int height, uint32_t color);
 void canvas_stroke_rect(Canvas *self, int x0, int y0, int width, int height, int border, uint32_t color);
 
@@ -33,4 +46,9 @@ int canvas_measure_text(const char *text, CanvasFont font, float scale, float le
 void canvas_draw_text(Canvas *self, const char *text, int text_x, int text_y, CanvasFont font, float scale,
                       uint32_t color, float letter_spacing);
 
+#ifdef GRAPHICS_STATS
+CanvasStats *canvas_get_stats(void);
+void canvas_reset_stats(void);
+#endif
+
 #endif // GRAPHICS_H_
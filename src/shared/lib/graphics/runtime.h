@@ -0,0 +1,52 @@
+#ifndef RUNTIME_H_
+#define RUNTIME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RT_FILL32_SEED_WORDS 16
+
+/**
+ * @brief Bulk memory primitives shared by graphics and every encoder. The builtins lower to memory.fill and
+ * memory.copy in WASM builds (-mbulk-memory) and to the libc routines natively. They are header-only so graphics.wasm,
+ * which links none of the barcode runtime, gets them too.
+ */
+static inline void rt_fill8(void *dest, uint8_t value, size_t n)
+{
+    __builtin_memset(dest, value, n);
+}
+
+static inline void rt_zero(void *dest, size_t n)
+{
+    __builtin_memset(dest, 0, n);
+}
+
+/**
+ * @brief Copies n bytes; like memory.copy, the regions may overlap.
+ */
+static inline void rt_copy(void *dest, const void *src, size_t n)
+{
+    __builtin_memmove(dest, src, n);
+}
+
+/**
+ * @brief Fills count words with value. A word made of one repeated byte, such as white or transparent, is a single
+ * byte fill; any other word is stored a few times and the filled prefix is then doubled with bulk copies.
+ */
+static inline void rt_fill32(uint32_t *dest, uint32_t value, size_t count)
+{
+    uint8_t low_byte = (uint8_t)value;
+    if (value == low_byte * 0x01010101u) {
+        rt_fill8(dest, low_byte, count * sizeof(uint32_t));
+        return;
+    }
+    size_t filled = 0;
+    for (; filled < count && filled < RT_FILL32_SEED_WORDS; ++filled)
+        dest[filled] = value;
+    for (; filled < count; filled *= 2) {
+        size_t chunk = (count - filled < filled) ? count - filled : filled;
+        rt_copy(dest + filled, dest, chunk * sizeof(uint32_t));
+    }
+}
+
+#endif // RUNTIME_H_
@@ -1,18 +1,163 @@
 const WASM_BASE_PATH = '/vislly/wasm';
+const WASM_MANIFEST = 'manifest.json';
+const WASM_CACHE_NAME = 'vislly-wasm';
+const WASM_MIME_TYPE = 'application/wasm';
+const SIMD_VARIANT_SUFFIX = '.simd';
 
-async function fetchBytes(fileName: string): Promise<ArrayBuffer> {
-  const response = await fetch(`${WASM_BASE_PATH}/${fileName}`);
+/**
+ * Smallest module using a v128 instruction (`i8x16.splat` + `i8x16.popcnt`);
+ * it only validates on engines with fixed-width SIMD support.
+ */
+const SIMD_PROBE_MODULE = new Uint8Array([
+  0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0, 10, 10, 1,
+  8, 0, 65, 0, 253, 15, 253, 98, 11,
+]);
+
+/**
+ * Content hash per binary, written by `to_wasm.sh`. Responses are cached under
+ * a hash-versioned URL so the engine can reuse its compiled code across loads.
+ */
+type WasmManifest = Readonly<Record<string, string>>;
+
+let isSimdSupported: boolean | null = null;
+let manifest: Promise<WasmManifest> | null = null;
+
+function supportsSimd(): boolean {
+  if (isSimdSupported === null) {
+    isSimdSupported = WebAssembly.validate(SIMD_PROBE_MODULE);
+  }
+  return isSimdSupported;
+}
+
+function toSimdVariant(fileName: string): string {
+  return fileName.replace(/\.wasm$/, `${SIMD_VARIANT_SUFFIX}.wasm`);
+}
+
+async function fetchManifest(): Promise<WasmManifest> {
+  try {
+    const response = await fetch(`${WASM_BASE_PATH}/${WASM_MANIFEST}`, {
+      cache: 'no-cache',
+    });
+    return response.ok ? await response.json() : {};
+  } catch {
+    return {};
+  }
+}
+
+function getManifest(): Promise<WasmManifest> {
+  if (manifest === null) {
+    manifest = fetchManifest();
+  }
+  return manifest;
+}
+
+async function openWasmCache(): Promise<Cache | null> {
+  if (typeof caches === 'undefined') {
+    return null;
+  }
+  try {
+    return await caches.open(WASM_CACHE_NAME);
+  } catch {
+    return null;
+  }
+}
+
+async function evictStaleVersions(cache: Cache, url: string): Promise<void> {
+  const { pathname, search } = new URL(url, location.href);
+  for (const request of await cache.keys()) {
+    const cached = new URL(request.url);
+    if (cached.pathname === pathname && cached.search !== search) {
+      await cache.delete(request);
+    }
+  }
+}
+
+async function fetchResponse(url: string): Promise<Response> {
+  const response = await fetch(url);
   if (!response.ok) {
     throw new Error(
-      `Failed to load WASM (${fileName}): ${response.status} ${response.statusText}`,
+      `Failed to load WASM (${url}): ${response.status} ${response.statusText}`,
     );
   }
-  return response.arrayBuffer();
+  return response;
+}
+
+async function fetchCachedResponse(
+  fileName: string,
+  hash: string | undefined,
+): Promise<Response> {
+  const url = `${WASM_BASE_PATH}/${fileName}`;
+  if (hash === undefined) {
+    return fetchResponse(url);
+  }
+  const versionedUrl = `${url}?v=${hash}`;
+  const cache = await openWasmCache();
+  const cached = await cache?.match(versionedUrl);
+  if (cached) {
+    return cached;
+  }
+  const response = await fetchResponse(versionedUrl);
+  if (cache) {
+    cache
+      .put(versionedUrl, response.clone())
+      .then(() => evictStaleVersions(cache, versionedUrl))
+      .catch(() => undefined);
+  }
+  return response;
+}
+
+/**
+ * The listed binary this engine loads for fileName: its SIMD variant when SIMD
+ * is supported and the variant is listed, else fileName itself if listed.
+ */
+function findListedVariant(
+  fileName: string,
+  hashes: WasmManifest,
+): string | undefined {
+  const simdFileName = toSimdVariant(fileName);
+  if (supportsSimd() && simdFileName in hashes) {
+    return simdFileName;
+  }
+  return fileName in hashes ? fileName : undefined;
+}
+
+async function fetchPreferredResponse(fileName: string): Promise<Response> {
+  const hashes = await getManifest();
+  const listedFileName = findListedVariant(fileName, hashes);
+  if (listedFileName !== undefined) {
+    return fetchCachedResponse(listedFileName, hashes[listedFileName]);
+  }
+  if (!supportsSimd()) {
+    return fetchCachedResponse(fileName, undefined);
+  }
+  try {
+    return await fetchCachedResponse(toSimdVariant(fileName), undefined);
+  } catch {
+    return fetchCachedResponse(fileName, undefined);
+  }
+}
+
+/**
+ * Whether the manifest lists the exact binary fetchWasmModule would load on
+ * this engine, so optional builds can be preferred without probing the server.
+ */
+async function hasWasmModule(fileName: string): Promise<boolean> {
+  return findListedVariant(fileName, await getManifest()) !== undefined;
+}
+
+async function compileResponse(
+  response: Response,
+): Promise<WebAssembly.Module> {
+  const contentType = response.headers.get('Content-Type') ?? '';
+  if (contentType.startsWith(WASM_MIME_TYPE)) {
+    return WebAssembly.compileStreaming(response);
+  }
+  return WebAssembly.compile(await response.arrayBuffer());
 }
 
 async function fetchWasmModule(fileName: string): Promise<WebAssembly.Module> {
-  const bytes = await fetchBytes(fileName);
-  return WebAssembly.compile(bytes);
+  const response = await fetchPreferredResponse(fileName);
+  return compileResponse(response);
 }
 
-export { fetchWasmModule };
+export { fetchWasmModule, hasWasmModule, supportsSimd };
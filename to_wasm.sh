@@ -6,10 +6,54 @@ OUT_DIR="$PROJECT_ROOT/public/wasm"
 CC="${CC:-clang}"
 CFLAGS="${CFLAGS:-}"
 WASMFLAGS="${WASMFLAGS:-}"
+OUT_SUFFIX="${OUT_SUFFIX:-}"
+GLOBAL_BASE="${GLOBAL_BASE:-}"
+SIMD_SUFFIX=".simd"
+STATIC_SUFFIX=".static"
+MANIFEST="$OUT_DIR/manifest.json"
 SOURCES=("$@")
 
+hash_file() {
+    if command -v sha256sum >/dev/null 2>&1; then
+        sha256sum "$1" | cut -c1-16
+    else
+        shasum -a 256 "$1" | cut -c1-16
+    fi
+}
+
+# A SIMD or static variant older than the baseline binary it was built alongside predates the last build
+is_stale_variant() {
+    local base="${1%.wasm}"
+    base="${base%"$SIMD_SUFFIX"}"
+    base="${base%"$STATIC_SUFFIX"}.wasm"
+    [[ "$base" != "$1" && -e "$base" && "$1" -ot "$base" ]]
+}
+
+# Maps every binary in OUT_DIR to a content hash; the loader keys its module cache on it. Stale variants are left
+# out so the loader never prefers them over a fresher baseline
+write_manifest() {
+    local separator=""
+    {
+        echo "{"
+        for wasm in "$OUT_DIR"/*.wasm; do
+            [[ -e "$wasm" ]] || continue
+            is_stale_variant "$wasm" && continue
+            printf '%s  "%s": "%s"' "$separator" "$(basename "$wasm")" "$(hash_file "$wasm")"
+            separator=$',\n'
+        done
+        printf '\n}\n'
+    } >"$MANIFEST"
+    echo -e "Updated: ${MANIFEST#"$PROJECT_ROOT"/}\n"
+}
+
+if [[ "${SOURCES[0]}" == "--manifest-only" ]]; then
+    mkdir -p "$OUT_DIR"
+    write_manifest
+    exit 0
+fi
+
 if [[ ${#SOURCES[@]} -eq 0 ]]; then
-    echo "Usage: ./to_wasm.sh <source_file_1> [source_file_2 ...]"
+    echo "Usage: ./to_wasm.sh [--manifest-only] <source_file_1> [source_file_2 ...]"
     exit 1
 fi
 
@@ -17,7 +61,7 @@ FIRST_SRC="${SOURCES[0]}"
 LIB_SOURCES="${SOURCES[*]:1}"
 LIB_TARGET="${LIB_SOURCES:-None}"
 FILENAME=$(basename "$FIRST_SRC" .c)
-OUT_WASM="$OUT_DIR/${FILENAME}.wasm"
+OUT_WASM="$OUT_DIR/${FILENAME}${OUT_SUFFIX}.wasm"
 
 mkdir -p "$OUT_DIR"
 
@@ -40,8 +84,14 @@ else
     echo "Static Linking against: $LIB_TARGET"
 fi
 
+if [[ -n "$GLOBAL_BASE" ]]; then
+    FLAGS+=("-Wl,--global-base=$GLOBAL_BASE")
+fi
+
 echo "Compiling $FILENAME"
 
 "$CC" "${FLAGS[@]}" -o "$OUT_WASM" "${SOURCES[@]}"
 
 echo -e "Built: ${OUT_WASM#"$PROJECT_ROOT"/}\n"
+
+write_manifest